@@ -77,7 +77,8 @@ tresult PLUGIN_API InharmonicController::setState(IBStream *state) {
 
   for (size_t i = 0; i < kNumAllParameters; i++) {
     double value = 0.5;
-    streamer.readDouble(value);
+    if (!streamer.readDouble(value))
+      value = kAllParameters[i].defaultValueNormalized;
     auto *param = parameters.getParameter(kAllParameters[i].tag);
     if (param) {
       param->setNormalized(value);
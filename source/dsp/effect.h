@@ -5,10 +5,16 @@
 #include <cmath>
 #include <vector>
 
+#include "fastmath.h"
+
 namespace Effect {
 
 namespace {
 static constexpr double kPi = 3.141592653589793238;
+// -120 dB, below which the state of an effect counts as silent
+static constexpr double kSilenceLevel = 1e-6;
+// s an effect takes to fade in or out as its mix leaves or reaches zero
+static constexpr double kBypassFadeTime = 0.005;
 template <typename T> static T fixDenormal(T x) {
   if (!std::isnormal(x))
     return 0;
@@ -16,6 +22,45 @@ template <typename T> static T fixDenormal(T x) {
 }
 } // namespace
 
+// The wet/dry mix of an effect that is bypassed at a mix of zero. Turning on
+// from zero or off to zero fades over kBypassFadeTime, so that neither
+// clicks; other changes step as they are set.
+template <typename T> class BypassMix {
+public:
+  // Returns true when the effect turns on from bypassed, when its state is
+  // stale and needs flushing.
+  bool set(T mix, T fs) {
+    const bool isTurningOn = !isActive() && mix != 0;
+    if ((_target == 0) != (mix == 0))
+      _fadeRemain =
+          std::max<size_t>(1, static_cast<size_t>(kBypassFadeTime * fs));
+    _target = mix;
+    if (_fadeRemain > 0)
+      _step = (_target - _value) / static_cast<T>(_fadeRemain);
+    else
+      _value = _target;
+    return isTurningOn;
+  }
+
+  bool isActive() const { return _target != 0 || _fadeRemain > 0; }
+
+  // the mix for the next sample
+  T next() {
+    if (_fadeRemain > 0) {
+      _value += _step;
+      if (--_fadeRemain == 0)
+        _value = _target;
+    }
+    return _value;
+  }
+
+private:
+  T _target = 0;
+  T _value = 0;
+  T _step = 0;
+  size_t _fadeRemain = 0;
+};
+
 template <typename T> class SampleDivider {
 public:
   void process(T &inoutL, T &inoutR) {
@@ -34,7 +79,29 @@ public:
     inoutR = _prevR;
   }
 
-  void setDivision(size_t div) { _n_divs = div; }
+  void process(T *inoutL, T *inoutR, size_t n) {
+    if (!isActive())
+      return;
+    for (size_t i = 0; i < n; i++) {
+      process(inoutL[i], inoutR[i]);
+    }
+  }
+
+  void setDivision(size_t div) {
+    // a new hold starts at the next sample
+    if (!isActive())
+      _phase = 0;
+    _n_divs = div;
+  }
+
+  // bypassed without division
+  bool isActive() const { return _n_divs > 1; }
+
+  // whether the output stays silent while the input does
+  bool isSilent() const {
+    return !isActive() || (std::abs(_prevL) < kSilenceLevel &&
+                           std::abs(_prevR) < kSilenceLevel);
+  }
 
 private:
   T _prevL = 0;
@@ -71,15 +138,31 @@ public:
     _delayR[2] = inoutR;
   }
 
+  void process(T *inoutL, T *inoutR, size_t n) {
+    if (!isActive())
+      return;
+    for (size_t i = 0; i < n; i++) {
+      process(inoutL[i], inoutR[i]);
+    }
+  }
+
   void setParameters(T fs, T freq, T gain_dB, T q) {
+    // At 0 dB the filter is the identity, for which no history is stale, so
+    // turning on from there starts from silence without a click.
+    if (!isActive() && gain_dB != 0) {
+      std::fill(_delayL, _delayL + 4, static_cast<T>(0));
+      std::fill(_delayR, _delayR + 4, static_cast<T>(0));
+    }
     _fs = fs;
     _freq = freq;
     _gain_dB = gain_dB;
     _q = q;
-    T a = std::pow(static_cast<T>(10), gain_dB / 40);
+    T a = static_cast<T>(Inharmonic::FastMath::pow10(gain_dB / 40.0));
     T w = 2 * static_cast<T>(kPi) * freq / fs;
-    T cosW = std::cos(w);
-    T sinW = std::sin(w);
+    double s, c;
+    Inharmonic::FastMath::sincos(w, s, c);
+    T cosW = static_cast<T>(c);
+    T sinW = static_cast<T>(s);
     T alpha = sinW / (2 * std::max(q, static_cast<T>(1e-3)));
     T b0 = 1 + alpha * a;
     T b1 = -2 * cosW;
@@ -98,6 +181,21 @@ public:
   void setGain(T gain_dB) { setParameters(_fs, _freq, gain_dB, _q); }
   void setQ(T q) { setParameters(_fs, _freq, _gain_dB, q); }
 
+  // bypassed at 0 dB
+  bool isActive() const { return _gain_dB != 0; }
+
+  // whether the output stays silent while the input does
+  bool isSilent() const {
+    if (!isActive())
+      return true;
+    for (size_t i = 0; i < 4; i++) {
+      if (std::abs(_delayL[i]) >= kSilenceLevel ||
+          std::abs(_delayR[i]) >= kSilenceLevel)
+        return false;
+    }
+    return true;
+  }
+
 private:
   T _fs = 48000;
   T _freq = 1000;
@@ -183,6 +281,15 @@ public:
 
   size_t size() const noexcept { return this->_state_buffer.size(); };
 
+  // the largest magnitude in the line
+  T peak() const {
+    T peak = 0;
+    for (const T x : this->_state_buffer) {
+      peak = std::max(peak, std::abs(x));
+    }
+    return peak;
+  }
+
 private:
   size_t _state_head;
   std::vector<T> _state_buffer;
@@ -199,7 +306,9 @@ public:
     return a + 0.5 * b;
   }
 
+  void reset() { this->_line.reset(); }
   size_t size() const noexcept { return this->_line.size(); };
+  T peak() const { return this->_line.peak(); }
 
 private:
   DelayLine<T> _line;
@@ -247,12 +356,26 @@ public:
         0.7 * sig1N + 0.3 * sig1D + 0.8 * sig2N + 0.2 * sig2D + sig3N + sig4D;
     T o2 =
         0.3 * sig1N + 0.7 * sig1D + 0.2 * sig2N + 0.8 * sig2D + sig3D + sig4N;
-    inoutL += _mix * (o1 - inoutL);
-    inoutR += _mix * (o2 - inoutR);
+    const T mix = _mix.next();
+    inoutL += mix * (o1 - inoutL);
+    inoutR += mix * (o2 - inoutR);
     _line1.push(fixDenormal(ap1));
     _line2.push(fixDenormal(ap2));
     _line3.push(fixDenormal(ap3));
     _line4.push(fixDenormal(ap4));
+
+    // the feedback decays by _attenuation per trip around the lines
+    const T level = std::max({std::abs(input), std::abs(ap1), std::abs(ap2),
+                              std::abs(ap3), std::abs(ap4)});
+    _quietCount = level < kSilenceLevel ? _quietCount + 1 : 0;
+  }
+
+  void process(T *inoutL, T *inoutR, size_t n) {
+    if (!isActive())
+      return;
+    for (size_t i = 0; i < n; i++) {
+      process(inoutL[i], inoutR[i]);
+    }
   }
 
   void setParameters(T fs, T t60) {
@@ -264,18 +387,63 @@ public:
     const size_t delayLength =
         _line1.size() + _line2.size() + _line3.size() + _line4.size();
     T totalDelayLength = sumAllpassLength / 8.0 + delayLength;
-    _attenuation = std::pow(10.0, -3.0 * totalDelayLength / (t60 * fs));
+    _attenuation = static_cast<T>(
+        Inharmonic::FastMath::pow10(-3.0 * totalDelayLength / (t60 * fs)));
   }
   void setSampleRate(T fs) { setParameters(fs, _t60); }
   void setTime(T t60) { setParameters(_fs, t60); }
-  void setMix(T mix) { _mix = mix; }
+  void setMix(T mix) {
+    if (_mix.set(mix, _fs))
+      flush();
+  }
+
+  // bypassed at a mix of zero
+  bool isActive() const { return _mix.isActive(); }
+
+  // Whether the output stays silent while the input does. Once every line has
+  // been refilled with silence, only the allpasses may still hold a tail,
+  // which halves at each pass through them, so they are scanned.
+  bool isSilent() const {
+    if (!isActive())
+      return true;
+    if (_quietCount < getLongestLine())
+      return false;
+    const T peak = std::max({_ap1a.peak(), _ap1b.peak(), _ap2a.peak(),
+                             _ap2b.peak(), _ap3a.peak(), _ap3b.peak(),
+                             _ap4a.peak(), _ap4b.peak()});
+    return peak < kSilenceLevel;
+  }
 
 private:
+  size_t getLongestLine() const {
+    return std::max(
+        {_line1.size(), _line2.size(), _line3.size(), _line4.size()});
+  }
+
+  // drops the tail left from before a bypass
+  void flush() {
+    _line1.reset();
+    _line2.reset();
+    _line3.reset();
+    _line4.reset();
+    _ap1a.reset();
+    _ap1b.reset();
+    _ap2a.reset();
+    _ap2b.reset();
+    _ap3a.reset();
+    _ap3b.reset();
+    _ap4a.reset();
+    _ap4b.reset();
+    _quietCount = getLongestLine();
+  }
+
   T _fs = 48000;
   T _t60 = 1;
-  T _mix = 0;
+  BypassMix<T> _mix;
 
   T _attenuation = 0;
+  // samples for which the input and the feedback have been silent
+  size_t _quietCount = 0;
   DelayLine<T> _line1, _line2, _line3, _line4;
   DelayLineAllpass<T> _ap1a, _ap1b, _ap2a, _ap2b, _ap3a, _ap3b, _ap4a, _ap4b;
 };
@@ -327,12 +495,25 @@ public:
     const T inR = inoutR;
     _lineL.push(inL);
     _lineR.push(inR);
+    _quietCount =
+        std::abs(inL) < kSilenceLevel && std::abs(inR) < kSilenceLevel
+            ? _quietCount + 1
+            : 0;
     const T chorusL =
         0.7 * _lineL.readInterp(offset1L) + 0.3 * _lineL.readInterp(offset2L);
     const T chorusR =
         0.7 * _lineR.readInterp(offset1R) + 0.3 * _lineR.readInterp(offset2R);
-    inoutL += _mix * (chorusL - inL);
-    inoutR += _mix * (chorusR - inR);
+    const T mix = _mix.next();
+    inoutL += mix * (chorusL - inL);
+    inoutR += mix * (chorusR - inR);
+  }
+
+  void process(T *inoutL, T *inoutR, size_t n) {
+    if (!isActive())
+      return;
+    for (size_t i = 0; i < n; i++) {
+      process(inoutL[i], inoutR[i]);
+    }
   }
 
   void setParameters(T fs, T delay, T freq) {
@@ -343,22 +524,60 @@ public:
     _lfo2.setParameters(_fs, _freq * 11 / 12);
     _lfo1.reset();
     _lfo2.reset();
-    _delaySamples = _delay * _fs * 1e-3;
+    setDelaySamples(_delay * _fs * 1e-3);
   }
   void setSampleRate(T fs) { setParameters(fs, _delay, _freq); }
-  void setDelayTime(T delay) { setParameters(_fs, delay, _freq); }
-  void setSpeed(T freq) { setParameters(_fs, _delay, freq); }
+  // these two keep the LFO phases, as they change on every ramp step
+  void setDelayTime(T delay) {
+    _delay = delay;
+    setDelaySamples(_delay * _fs * 1e-3);
+  }
+  void setSpeed(T freq) {
+    _freq = freq;
+    _lfo1.setFrequency(_freq);
+    _lfo2.setFrequency(_freq * 11 / 12);
+  }
   void setDepth(T depth) { _depth = depth; }
-  void setMix(T mix) { _mix = mix; }
+  void setMix(T mix) {
+    if (_mix.set(mix, _fs)) {
+      // drops the input from before a bypass
+      _lineL.reset();
+      _lineR.reset();
+      _quietCount = _lineL.size();
+    }
+  }
+
+  // bypassed at a mix of zero
+  bool isActive() const { return _mix.isActive(); }
+
+  // whether the output stays silent while the input does, which it does once
+  // the silence reaches past the longest delay the LFOs sweep to
+  bool isSilent() const {
+    return !isActive() ||
+           static_cast<T>(_quietCount) > 2 * _delaySamples + 1;
+  }
 
 private:
+  // A longer delay would reach past the silence into the input from before
+  // it, so a silent chorus drops that input and stays silent.
+  void setDelaySamples(T delaySamples) {
+    const bool wasSilent = isSilent();
+    _delaySamples = delaySamples;
+    if (wasSilent && !isSilent()) {
+      _lineL.reset();
+      _lineR.reset();
+      _quietCount = _lineL.size();
+    }
+  }
+
   T _fs = 48000;
   T _delay = 8;
   T _freq = 1;
   T _depth = 1;
-  T _mix = 0;
+  BypassMix<T> _mix;
 
   T _delaySamples = 384;
+  size_t _quietCount = 0;
 
   TriangleLFO<T> _lfo1;
   TriangleLFO<T> _lfo2;
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Polynomial stand-ins for the libm calls of the parameter and modulation
+// paths. They have no branches or table reads, so loops over them vectorize,
+// and their errors stay far below what the synth can resolve. Building with
+// INHARMONIC_FAST_MATH=0 maps every function back to libm.
+#ifndef INHARMONIC_FAST_MATH
+#define INHARMONIC_FAST_MATH 1
+#endif
+
+namespace Inharmonic {
+namespace FastMath {
+
+namespace Detail {
+// q(f), a Chebyshev fit of degree 7 to (2^f - 1) / f for f in [-0.5, 0.5],
+// highest power first; the voice bank evaluates it in the same order
+static constexpr double kExp2Poly[] = {
+    1.3250805530013318e-06, 1.5303700711584888e-05, 0.00015403475186471385,
+    0.0013333478473684425,  0.009618129135236224,   0.055504109063258679,
+    0.24022650695888502,    0.69314718055683241,
+};
+static constexpr size_t kExp2PolySize =
+    sizeof(kExp2Poly) / sizeof(kExp2Poly[0]);
+} // namespace Detail
+
+// 2^x, to a relative error of 2.2e-12 for |x| < 1022, and exact at integers.
+// The polynomial covers the fraction in [-0.5, 0.5] and the exponent bits
+// scale it.
+static inline double exp2(double x) {
+#if INHARMONIC_FAST_MATH
+  x = std::min(1022.0, std::max(-1022.0, x));
+  // round to nearest by truncating a positive number, as floor() is a call
+  // without SSE4.1
+  const int32_t i = static_cast<int32_t>(x + 1023.5) - 1023;
+  const double f = x - static_cast<double>(i);
+  // 1 + f q(f)
+  double q = Detail::kExp2Poly[0];
+  for (size_t j = 1; j < Detail::kExp2PolySize; j++)
+    q = q * f + Detail::kExp2Poly[j];
+  const double p = 1.0 + f * q;
+  const uint64_t bits = static_cast<uint64_t>(static_cast<uint32_t>(i + 1023))
+                        << 52;
+  double scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+#else
+  return std::exp2(x);
+#endif
+}
+
+namespace Detail {
+// x = k pi + r with |r| <= pi / 2, pi split in two to keep r exact; returns
+// (-1)^k
+static inline double reducePi(double x, double &r) {
+  constexpr double kPiHi = 3.141592653589793116;
+  constexpr double kPiLo = 1.2246467991473532e-16;
+  const double y = x * (1.0 / kPiHi);
+  // rounds to nearest by truncation, which vectorizes where floor() may not
+  const int32_t ki = static_cast<int32_t>(y + (y < 0 ? -0.5 : 0.5));
+  const double k = static_cast<double>(ki);
+  r = (x - k * kPiHi) - k * kPiLo;
+  return (ki & 1) ? -1.0 : 1.0;
+}
+
+// sin(r) for |r| <= pi / 2, an odd Chebyshev fit of degree 11
+static inline double sinPoly(double r) {
+  const double u = r * r;
+  double p = -2.3889217773608724e-08;
+  p = p * u + 2.7525269812308471e-06;
+  p = p * u + -0.00019840861179319759;
+  p = p * u + 0.0083333309742075846;
+  p = p * u + -0.16666666616815567;
+  p = p * u + 0.99999999998291911;
+  return p * r;
+}
+
+// cos(r) for |r| <= pi / 2, 1 + r^2 q(r^2) with q a Chebyshev fit of
+// degree 5
+static inline double cosPoly(double r) {
+  const double u = r * r;
+  double q = 2.0043838864520675e-09;
+  q = q * u + -2.7534343195781309e-07;
+  q = q * u + 2.4801294210164916e-05;
+  q = q * u + -0.0013888887196553725;
+  q = q * u + 0.041666666630901797;
+  q = q * u + -0.49999999999877453;
+  return 1.0 + u * q;
+}
+} // namespace Detail
+
+// sin(x), to an absolute error of 2.7e-11 for |x| < 1e5 (the reduction by
+// pi adds rounding that grows with |x|, 1e-15 at 100 pi and 1e-11 at 1e5)
+static inline double sin(double x) {
+#if INHARMONIC_FAST_MATH
+  double r;
+  const double sign = Detail::reducePi(x, r);
+  return sign * Detail::sinPoly(r);
+#else
+  return std::sin(x);
+#endif
+}
+
+// cos(x), to an absolute error of 3.1e-12 for |x| < 100 pi, where the
+// rounding of the reduction starts to show
+static inline double cos(double x) {
+#if INHARMONIC_FAST_MATH
+  double r;
+  const double sign = Detail::reducePi(x, r);
+  return sign * Detail::cosPoly(r);
+#else
+  return std::cos(x);
+#endif
+}
+
+// sin(x) and cos(x) with one reduction
+static inline void sincos(double x, double &s, double &c) {
+#if INHARMONIC_FAST_MATH
+  double r;
+  const double sign = Detail::reducePi(x, r);
+  s = sign * Detail::sinPoly(r);
+  c = sign * Detail::cosPoly(r);
+#else
+  s = std::sin(x);
+  c = std::cos(x);
+#endif
+}
+
+// 10^x, to a relative error of 2.2e-12 plus 7.7e-16 |x|
+static inline double pow10(double x) {
+#if INHARMONIC_FAST_MATH
+  return exp2(x * 3.3219280948873623);
+#else
+  return std::pow(10.0, x);
+#endif
+}
+
+} // namespace FastMath
+} // namespace Inharmonic
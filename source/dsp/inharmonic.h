@@ -3,28 +3,36 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <random>
+#include <vector>
+
+#include "costable.h"
+#include "fastmath.h"
+#include "partialbank.h"
+#include "renderpool.h"
+#include "spectralbank.h"
+#include "voicebank.h"
+
+// Samples between two evaluations of the vibrato and filter modulation, which
+// are interpolated in between.
+#ifndef INHARMONIC_CONTROL_INTERVAL
+#define INHARMONIC_CONTROL_INTERVAL 16
+#endif
 
 namespace Inharmonic {
 
 namespace {
 static constexpr double kPi = 3.141592653589793238;
-static constexpr size_t kTableSize = 8192;
-static double cosTable[kTableSize] = {};
-
-static inline void initializeCosTable() {
-  if (cosTable[0] != 0)
-    return;
-  for (size_t i = 0; i < kTableSize; i++) {
-    cosTable[i] = cos(2.0 * kPi * i / kTableSize);
-  }
-}
+} // namespace
 
-static inline double unsafeFastCos2pi(const double &x) {
-  return cosTable[static_cast<int>(x * kTableSize)];
-}
+// The largest block any render stage processes at once. Callers split longer
+// buffers so that per-block scratch space can live on the stack.
+static constexpr size_t kMaxBlockSize = 64;
 
-} // namespace
+static constexpr size_t kControlInterval = INHARMONIC_CONTROL_INTERVAL;
+static_assert(kControlInterval > 0, "the control interval must be positive");
 
 class PseudoRandom {
 public:
@@ -44,81 +52,538 @@ private:
   uint32_t _seed = 0;
 };
 
-class InharmonicOscillator {
+enum class OscMode {
+  kTable,  // kCosTable lookups with a phase accumulator
+  kPhasor, // complex rotation per partial, no table
+  kIfft,   // inverse FFT per hop, see SpectralPartialBank
+};
+
+// partials per oscillator, n = 1 to kMaxPartials
+static constexpr size_t kMaxPartials = 127;
+
+// The frequency ratios n sqrt(1 + B n^2) of the partials of an inharmonic
+// series over its fundamental, and their amplitudes 1 / ratio.
+struct PartialRatios {
+  double ratio[kMaxPartials];
+  double amp[kMaxPartials];
+};
+
+// Keeps the PartialRatios of recently used inharmonicities, so that note-ons
+// and parameter changes look them up instead of taking a sqrt per partial.
+// Direct mapped with a fixed number of slots, it never allocates, and a
+// collision only costs a recomputation.
+class PartialRatioCache {
+public:
+  const PartialRatios &get(double inharmonicB) {
+    Entry &entry = _entries[getSlot(inharmonicB)];
+    if (!entry.isValid || entry.inharmonicB != inharmonicB) {
+      compute(inharmonicB, entry.ratios);
+      entry.inharmonicB = inharmonicB;
+      entry.isValid = true;
+    }
+    return entry.ratios;
+  }
+
+  // The cached ratios of inharmonicB, or nullptr. It only reads, so the
+  // render threads may call it while the audio thread waits for them.
+  const PartialRatios *find(double inharmonicB) const {
+    const Entry &entry = _entries[getSlot(inharmonicB)];
+    if (!entry.isValid || entry.inharmonicB != inharmonicB)
+      return nullptr;
+    return &entry.ratios;
+  }
+
+  static void compute(double inharmonicB, PartialRatios &ratios) {
+    for (size_t i = 0; i < kMaxPartials; i++) {
+      const double n = static_cast<double>(i + 1);
+      const double ratio = n * sqrt(1.0 + inharmonicB * n * n);
+      ratios.ratio[i] = ratio;
+      ratios.amp[i] = 1.0 / ratio;
+    }
+  }
+
+private:
+  static constexpr size_t kSlotBits = 6;
+
+  static size_t getSlot(double inharmonicB) {
+    uint64_t bits;
+    std::memcpy(&bits, &inharmonicB, sizeof(bits));
+    // key-followed values differ all over the mantissa, so mix the bits
+    bits ^= bits >> 31;
+    bits *= 0xbf58476d1ce4e5b9ULL;
+    return static_cast<size_t>(bits >> (64 - kSlotBits));
+  }
+
+  struct Entry {
+    double inharmonicB = 0;
+    bool isValid = false;
+    PartialRatios ratios;
+  };
+  Entry _entries[size_t(1) << kSlotBits];
+};
+
+// Renders the two oscillators of a voice, up to 127 partials each, as one
+// partial list. The partials of both are merged by frequency into the lanes
+// of a single partial bank, with the oscillator mix folded into their
+// amplitudes, and a muted oscillator has no lanes at all.
+//
+// The partial bank runs on T phases, which would drift from the true pitch
+// over long notes in float, so the exact phase of every partial is also
+// tracked in double as an anchor phase plus the modulated time elapsed since,
+// and the T state is resynced to it every kResyncInterval samples.
+template <typename T> class InharmonicOscillator {
 public:
   InharmonicOscillator() {
     std::random_device seedGen;
     std::mt19937 metaRng(seedGen());
-    for (size_t i = 0; i < kMaxSines; i++) {
-      uint32_t seed = metaRng();
-      _rng[i].seed(seed);
+    for (size_t s = 0; s < kNumOscs; s++) {
+      for (size_t i = 0; i < kMaxSines; i++) {
+        uint32_t seed = metaRng();
+        _rng[s][i].seed(seed);
+      }
     }
-    initializeCosTable();
+    _kernels = &getPartialBankKernels<T>();
+  }
+
+  void setMode(OscMode mode) {
+    if (_mode == mode)
+      return;
+    _mode = mode;
+    resync();
+    if (_mode == OscMode::kPhasor)
+      updateRotors();
   }
 
   void resetStateRandom() {
-    for (size_t i = 0; i < kMaxSines; i++) {
-      _phase[i] = _rng[i].next();
+    for (size_t s = 0; s < kNumOscs; s++) {
+      for (size_t i = 0; i < kMaxSines; i++) {
+        _anchor[s][i] = _rng[s][i].next();
+      }
     }
+    _elapsed = 0;
+    resync();
   }
 
   void resetStateZero() {
-    for (size_t i = 0; i < kMaxSines; i++) {
-      _phase[i] = 0;
+    for (size_t s = 0; s < kNumOscs; s++) {
+      for (size_t i = 0; i < kMaxSines; i++) {
+        _anchor[s][i] = 0;
+      }
     }
+    _elapsed = 0;
+    resync();
   }
 
-  void setFreq(double f, double inharmonicB) {
-    const double thresh = 0.5 / f;
-    size_t i = 0;
-    for (i = 1; i < kMaxSines; i++) {
-      // const double scale = i * (1.0 + 0.5 * inharmonicB * i * i);
-      const double scale = i * sqrt(1.0 + inharmonicB * i * i);
-      if (scale >= thresh)
+  // Takes the partial ratios of oscillator osc, which apply from the next
+  // setFreq on.
+  void setRatios(size_t osc, const PartialRatios &ratios) {
+    std::copy(ratios.ratio, ratios.ratio + kMaxPartials, _ratio[osc]);
+    std::copy(ratios.amp, ratios.amp + kMaxPartials, _ampExact[osc]);
+    resetOrder();
+  }
+
+  // Sets the fundamental to f (cycles per sample). The steps are the cached
+  // ratios scaled by f, so a pitch bend costs no more than that.
+  void setFreq(double f) {
+    // re-anchor the phases before the steps change
+    advanceAnchors();
+
+    const double thresh = std::min(0.5, _ceiling) / f;
+    for (size_t s = 0; s < kNumOscs; s++) {
+      size_t i = 0;
+      for (; i < kMaxPartials && _ratio[s][i] < thresh; i++)
+        _stepsExact[s][i] = _ratio[s][i] * f;
+      _numSines[s] = i;
+      // partials above the cutoff hold their phase until they come back
+      for (; i < kMaxSines; i++)
+        _stepsExact[s][i] = 0;
+    }
+    updateLanes();
+  }
+
+  // Leaves out the partials at or above step (cycles per sample) from the next
+  // setFreq on, as it does those above Nyquist.
+  void setCeiling(double step) { _ceiling = step; }
+
+  void setMix(double gain1, double gain2) {
+    if (gain1 == _gain[0] && gain2 == _gain[1])
+      return;
+    advanceAnchors();
+    _gain[0] = gain1;
+    _gain[1] = gain2;
+    resetOrder();
+    updateLanes();
+  }
+
+  // the partials of the unmuted oscillators below the ceiling, by ascending
+  // frequency, with the mix applied
+  size_t getNumPartials() const { return _numPartials; }
+  double getPartialStep(size_t i) const {
+    return _stepsExact[_laneOsc[i]][_laneSine[i]];
+  }
+  double getPartialAmp(size_t i) const { return _amp[i]; }
+
+  // Renders only the first n partials until the next setFreq or setMix. The
+  // others keep their exact phases and rejoin in tune.
+  void setActivePartials(size_t n) {
+    const size_t lanes = std::min(_numLanes, roundUpToLanes(n));
+    for (size_t i = _numActiveLanes; i < lanes; i++) {
+      if (i >= _numPartials)
         break;
-      _amp[i] = 1.0 / scale;
-      _steps[i] = scale * f;
+      const size_t s = _laneOsc[i];
+      const size_t j = _laneSine[i];
+      double phase = _anchor[s][j] + _stepsExact[s][j] * _elapsed;
+      phase -= floor(phase);
+      _phase[i] = static_cast<T>(phase);
+      if (_mode == OscMode::kPhasor) {
+        double re, im;
+        FastMath::sincos(2.0 * kPi * phase, im, re);
+        _re[i] = static_cast<T>(re);
+        _im[i] = static_cast<T>(im);
+      }
+    }
+    _numActiveLanes = lanes;
+  }
+
+  // Renders n <= kMaxBlockSize samples into out, with the frequency scaled by
+  // oscMod[t] at each sample.
+  void process(T *out, const T *oscMod, size_t n) {
+    if (_mode == OscMode::kTable) {
+      _kernels->table(_amp, _steps, _phase, _numActiveLanes, oscMod, out,
+                      n, kCosTable.data, static_cast<T>(kCosTableSize));
+    } else {
+      // the rotors stay fixed over each run of equal modulation
+      size_t t = 0;
+      while (t < n) {
+        const T mod = oscMod[t];
+        size_t len = 1;
+        while (t + len < n && oscMod[t + len] == mod)
+          len++;
+
+        const T *rotRe = _rotRe;
+        const T *rotIm = _rotIm;
+        if (mod != 1) {
+          if (mod != _modRotorsMod)
+            updateModRotors(mod);
+          rotRe = _modRotRe;
+          rotIm = _modRotIm;
+        }
+        _kernels->phasor(_amp, rotRe, rotIm, _re, _im, _numActiveLanes,
+                         out + t, len);
+        t += len;
+      }
     }
-    _numSines = i;
+
+    double elapsed = 0;
+    for (size_t t = 0; t < n; t++)
+      elapsed += oscMod[t];
+    _elapsed += elapsed;
+
+    // this also pulls the phasors back onto the unit circle
+    _resyncCount += n;
+    if (_resyncCount >= kResyncInterval)
+      resync();
   }
 
-  double process(double oscMod) {
-    double out = 0;
-    for (size_t i = 1; i < _numSines; i++) {
-      out += _amp[i] * unsafeFastCos2pi(_phase[i]);
-      _phase[i] += _steps[i] * oscMod;
-      _phase[i] -= static_cast<int>(_phase[i]);
+  // Adds the partials to the bank's next frame and advances their phases by
+  // one hop. Under OscMode::kIfft this replaces process(), and the anchors
+  // hold the phases at the next frame center.
+  void addFrame(SpectralPartialBank<T> &bank, T oscMod) {
+    const double mod = oscMod;
+    const size_t numActive = std::min(_numPartials, _numActiveLanes);
+    for (size_t i = 0; i < numActive; i++) {
+      const double phase = _anchor[_laneOsc[i]][_laneSine[i]];
+      const double sinPhase = phase < 0.25 ? phase + 0.75 : phase - 0.25;
+      bank.addPartial(_amp[i] * static_cast<T>(interpolatedCos2pi(phase)),
+                      _amp[i] * static_cast<T>(interpolatedCos2pi(sinPhase)),
+                      getPartialStep(i) * mod);
+    }
+
+    const double hop = mod * kSpectralHopSize;
+    for (size_t s = 0; s < kNumOscs; s++) {
+      for (size_t i = 0; i < kMaxSines; i++) {
+        const double next = _anchor[s][i] + _stepsExact[s][i] * hop;
+        _anchor[s][i] = next - floor(next);
+      }
     }
-    return out;
   }
 
 private:
+  static size_t roundUpToLanes(size_t n) {
+    return (n + kPartialBankLanes - 1) / kPartialBankLanes * kPartialBankLanes;
+  }
+
+  // Restarts the merge of the partials of the unmuted oscillators by ratio.
+  // As both scale by the same fundamental, this is also their order by
+  // frequency. It is extended lazily, only as far as the lanes reach.
+  void resetOrder() {
+    _orderSize = 0;
+    for (size_t s = 0; s < kNumOscs; s++)
+      _mergeNext[s] = 0;
+  }
+
+  // Appends the next partial to the merged order, if there is one left.
+  bool extendOrder() {
+    size_t s = kNumOscs;
+    for (size_t c = 0; c < kNumOscs; c++) {
+      const size_t j = _mergeNext[c];
+      if (_gain[c] != 0 && j < kMaxPartials &&
+          (s == kNumOscs || _ratio[c][j] < _ratio[s][_mergeNext[s]]))
+        s = c;
+    }
+    if (s == kNumOscs)
+      return false;
+    _orderOsc[_orderSize] = static_cast<uint8_t>(s);
+    _orderSine[_orderSize] = static_cast<uint8_t>(_mergeNext[s]++);
+    _orderSize++;
+    return true;
+  }
+
+  // Lays the partials below the cutoff out in the lanes, which is a prefix of
+  // the merged order. The anchors must be current.
+  void updateLanes() {
+    size_t i = 0;
+    for (;; i++) {
+      if (i == _orderSize && !extendOrder())
+        break;
+      const size_t s = _orderOsc[i];
+      const size_t j = _orderSine[i];
+      if (j >= _numSines[s])
+        break;
+      _laneOsc[i] = static_cast<uint8_t>(s);
+      _laneSine[i] = static_cast<uint8_t>(j);
+      _amp[i] = static_cast<T>(_gain[s] * _ampExact[s][j]);
+      _steps[i] = static_cast<T>(_stepsExact[s][j]);
+      _phase[i] = static_cast<T>(_anchor[s][j]);
+      if (_mode == OscMode::kPhasor) {
+        double re, im;
+        FastMath::sincos(2.0 * kPi * _anchor[s][j], im, re);
+        _re[i] = static_cast<T>(re);
+        _im[i] = static_cast<T>(im);
+      }
+    }
+
+    _numPartials = i;
+    _numLanes = roundUpToLanes(i);
+    _numActiveLanes = _numLanes;
+
+    // silence the padding lanes up to the kernel width
+    for (; i < _numLanes; i++) {
+      _amp[i] = 0;
+      _steps[i] = 0;
+    }
+
+    if (_mode == OscMode::kPhasor)
+      updateRotors();
+  }
+
+  // Moves the anchors up to the current sample.
+  void advanceAnchors() {
+    for (size_t s = 0; s < kNumOscs; s++) {
+      for (size_t i = 0; i < kMaxSines; i++) {
+        double phase = _anchor[s][i] + _stepsExact[s][i] * _elapsed;
+        phase -= floor(phase);
+        _anchor[s][i] = phase;
+      }
+    }
+    _elapsed = 0;
+    _resyncCount = 0;
+  }
+
+  void resync() {
+    advanceAnchors();
+    for (size_t i = 0; i < _numPartials; i++) {
+      const double phase = _anchor[_laneOsc[i]][_laneSine[i]];
+      _phase[i] = static_cast<T>(phase);
+      if (_mode == OscMode::kPhasor) {
+        double re, im;
+        FastMath::sincos(2.0 * kPi * phase, im, re);
+        _re[i] = static_cast<T>(re);
+        _im[i] = static_cast<T>(im);
+      }
+    }
+  }
+
+  void updateRotors() {
+    for (size_t i = 0; i < _numLanes; i++) {
+      const double step = i < _numPartials ? getPartialStep(i) : 0.0;
+      double re, im;
+      FastMath::sincos(2.0 * kPi * step, im, re);
+      _rotRe[i] = static_cast<T>(re);
+      _rotIm[i] = static_cast<T>(im);
+    }
+    _modRotorsMod = 1;
+  }
+
+  void updateModRotors(T oscMod) {
+    // rotate each rotor further by d = 2 pi step (oscMod - 1). Vibrato keeps
+    // |d| < 0.25, where these Taylor terms are accurate to 1e-10.
+    const T k = static_cast<T>(2.0 * kPi) * (oscMod - 1);
+    for (size_t i = 0; i < _numLanes; i++) {
+      const T d = _steps[i] * k;
+      const T d2 = d * d;
+      const T c = 1 + d2 * (T(-1.0 / 2) +
+                            d2 * (T(1.0 / 24) + d2 * T(-1.0 / 720)));
+      const T s = d * (1 + d2 * (T(-1.0 / 6) +
+                                 d2 * (T(1.0 / 120) + d2 * T(-1.0 / 5040))));
+      _modRotRe[i] = _rotRe[i] * c - _rotIm[i] * s;
+      _modRotIm[i] = _rotRe[i] * s + _rotIm[i] * c;
+    }
+    _modRotorsMod = oscMod;
+  }
+
+  static constexpr size_t kNumOscs = 2;
   static constexpr size_t kMaxSines = 128;
-  PseudoRandom _rng[kMaxSines];
-  size_t _numSines = 1;
-  double _amp[kMaxSines] = {};
-  double _steps[kMaxSines] = {};
-  double _phase[kMaxSines] = {};
+  static constexpr size_t kMaxLanes = kNumOscs * kMaxSines;
+  static constexpr size_t kResyncInterval = 1024;
+  static_assert(kMaxSines % kPartialBankLanes == 0,
+                "kMaxSines must be a multiple of the partial bank width");
+  static_assert(kMaxPartials < kMaxSines, "kMaxSines must hold every partial");
+  PseudoRandom _rng[kNumOscs][kMaxSines];
+  const PartialBankKernels<T> *_kernels = nullptr;
+  OscMode _mode = OscMode::kTable;
+  double _gain[kNumOscs] = {1.0, 1.0};
+  double _ceiling = 0.5;
+  size_t _numSines[kNumOscs] = {};
+  size_t _numPartials = 0;
+  size_t _numLanes = 0;
+  size_t _numActiveLanes = 0;
+  size_t _resyncCount = 0;
+  double _elapsed = 0;
+  T _modRotorsMod = 1;
+  double _anchor[kNumOscs][kMaxSines] = {};
+  double _stepsExact[kNumOscs][kMaxSines] = {};
+  double _ampExact[kNumOscs][kMaxSines] = {};
+  double _ratio[kNumOscs][kMaxSines] = {};
+  // the partials of the unmuted oscillators by ascending ratio
+  uint8_t _orderOsc[kMaxLanes] = {};
+  uint8_t _orderSine[kMaxLanes] = {};
+  size_t _orderSize = 0;
+  size_t _mergeNext[kNumOscs] = {};
+  // which oscillator and sine each lane renders
+  uint8_t _laneOsc[kMaxLanes] = {};
+  uint8_t _laneSine[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _amp[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _steps[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _phase[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _re[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _im[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _rotRe[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _rotIm[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _modRotRe[kMaxLanes] = {};
+  alignas(kPartialBankAlign) T _modRotIm[kMaxLanes] = {};
 };
 
-class StateVariableFilter {
+// The SVF coefficient k = 2 sin(pi f / fs) by log2 of the cutoff f, at
+// kStepsPerOctave entries per octave up from 20 Hz and clamped at 0.9 fs / 2
+// like StateVariableFilter::setFreq(), so that a modulated cutoff needs
+// neither an exp2() nor a sin(). Interpolated, it is within 0.03 cents of the
+// exact cutoff. Built once per sample rate and shared by the voices of a
+// synth.
+class SvfCutoffTable {
+public:
+  SvfCutoffTable() { setSampleRate(48000); }
+
+  void setSampleRate(double fs) {
+    fs = std::max(8000.0, fs);
+    for (size_t i = 0; i < kSize; i++) {
+      const double log2Freq =
+          kMinLog2Freq + static_cast<double>(i) / kStepsPerOctave;
+      const double f = std::min(0.9 * fs / 2.0, std::exp2(log2Freq));
+      _k[i] = 2 * std::sin(kPi * f / fs);
+    }
+  }
+
+  double getK(double log2Freq) const {
+    const double x = std::max(
+        0.0, std::min(static_cast<double>(kSize - 1),
+                      (log2Freq - kMinLog2Freq) * kStepsPerOctave));
+    const size_t i = std::min(static_cast<size_t>(x), kSize - 2);
+    const double frac = x - static_cast<double>(i);
+    return _k[i] + frac * (_k[i + 1] - _k[i]);
+  }
+
+private:
+  // log2(20)
+  static constexpr double kMinLog2Freq = 4.3219280948873623;
+  static constexpr double kStepsPerOctave = 64;
+  // 16 octaves, past the clamp at any sample rate up to 2.9 MHz
+  static constexpr size_t kSize = 1024;
+  double _k[kSize];
+};
+
+template <typename T> class StateVariableFilter {
 public:
   void resetState() { _p1 = _p2 = _p3 = _p4 = 0; }
 
+  // takes effect at the next setFreq() or rampK()
+  void setQ(double q) { _oq = 1.0 / q; }
+
   void setFreq(double f, double fs, double q) {
-    f = std::max(20.0, std::min(0.9 * fs / 2.0, f));
-    _k = 2 * sin(kPi * f / fs);
-    _oqk = 1.0 / q + _k;
-    _denom = 1.0 + _k * _oqk;
+    setQ(q);
+    const double k = getK(f, fs);
+    const double oqk = _oq + k;
+    _k = static_cast<T>(k);
+    _oqk = static_cast<T>(oqk);
+    _invDenom = static_cast<T>(1.0 / (1.0 + k * oqk));
+    _kStep = _oqkStep = _invDenomStep = 0;
   }
 
-  double process(double x, short type, short iter) {
+  // Heads for coefficient k (see SvfCutoffTable) over the next n samples of
+  // processRamp(), moving k, oqk and 1 / denom in equal steps, so that no
+  // sample pays for a sin() or a division. 1 / denom is not linear in k, so
+  // each sample refines its step with a Newton iteration, which squares the
+  // error of the chord; a jump by more than an octave or so, where the chord
+  // strays too far for that, divides instead.
+  void rampK(double k, size_t n) {
+    _isSteep = getRamp(k, n, _k, _oqk, _invDenom, _kStep, _oqkStep,
+                       _invDenomStep);
+  }
+
+  // rampK() for the filter in lane l of a bank
+  void rampLane(SvfBankLanes<T> &lanes, size_t l, double k, size_t n) const {
+    const bool isSteep =
+        getRamp(k, n, lanes.k[l], lanes.oqk[l], lanes.invDenom[l],
+                lanes.kStep[l], lanes.oqkStep[l], lanes.invDenomStep[l]);
+    lanes.steep[l] = isSteep ? 1 : 0;
+  }
+
+  void processRamp(T *inout, size_t n, short type, short iter) {
+    if (_isSteep) {
+      for (size_t t = 0; t < n; t++) {
+        _k += _kStep;
+        _oqk += _oqkStep;
+        _invDenom = 1 / (1 + _k * _oqk);
+        inout[t] = process(inout[t], type, iter);
+      }
+      return;
+    }
+    for (size_t t = 0; t < n; t++) {
+      _k += _kStep;
+      _oqk += _oqkStep;
+      _invDenom += _invDenomStep;
+      _invDenom *= 2 - (1 + _k * _oqk) * _invDenom;
+      inout[t] = process(inout[t], type, iter);
+    }
+  }
+
+  void process(T *inout, size_t n, short type, short iter) {
+    if (iter == 0) {
+      for (size_t t = 0; t < n; t++)
+        inout[t] = process(inout[t], type, 0);
+    } else {
+      for (size_t t = 0; t < n; t++)
+        inout[t] = process(inout[t], type, 1);
+    }
+  }
+
+  T process(T x, short type, short iter) {
     // V. Lazzarini and J. Timoney: "Improving the Chamberlin Digital State
     // Variable Filter" (2021) <https://arxiv.org/abs/2111.05592>
-    double u, res[3];
+    T u, res[3];
 
     // HPF1
-    res[1] = (x - _oqk * _p1 - _p2) / _denom;
+    res[1] = (x - _oqk * _p1 - _p2) * _invDenom;
 
     // BPF1
     u = res[1] * _k;
@@ -134,7 +599,7 @@ public:
       return res[type];
 
     // HPF2
-    res[1] = (res[type] - _oqk * _p3 - _p4) / _denom;
+    res[1] = (res[type] - _oqk * _p3 - _p4) * _invDenom;
 
     // BPF2
     u = res[1] * _k;
@@ -149,106 +614,297 @@ public:
     return res[type];
   }
 
+  // Moves the state into lane l of a bank, and back.
+  void storeLane(SvfBankLanes<T> &lanes, size_t l) const {
+    lanes.k[l] = _k;
+    lanes.oqk[l] = _oqk;
+    lanes.invDenom[l] = _invDenom;
+    lanes.kStep[l] = _kStep;
+    lanes.oqkStep[l] = _oqkStep;
+    lanes.invDenomStep[l] = _invDenomStep;
+    lanes.steep[l] = _isSteep ? 1 : 0;
+    lanes.p1[l] = _p1;
+    lanes.p2[l] = _p2;
+    lanes.p3[l] = _p3;
+    lanes.p4[l] = _p4;
+  }
+  void loadLane(const SvfBankLanes<T> &lanes, size_t l) {
+    _k = lanes.k[l];
+    _oqk = lanes.oqk[l];
+    _invDenom = lanes.invDenom[l];
+    _kStep = lanes.kStep[l];
+    _oqkStep = lanes.oqkStep[l];
+    _invDenomStep = lanes.invDenomStep[l];
+    _isSteep = lanes.steep[l] != 0;
+    _p1 = lanes.p1[l];
+    _p2 = lanes.p2[l];
+    _p3 = lanes.p3[l];
+    _p4 = lanes.p4[l];
+  }
+
 private:
-  double _k = 0;
-  double _oqk = 0;
-  double _denom = 1;
-  double _p1 = 0;
-  double _p2 = 0;
-  double _p3 = 0;
-  double _p4 = 0;
+  // Sets the steps from the coefficients (k0, oqk0, invDenom0) to those of
+  // k over n samples, and returns whether they are too steep for the chord.
+  bool getRamp(double k, size_t n, T k0, T oqk0, T invDenom0, T &kStep,
+               T &oqkStep, T &invDenomStep) const {
+    const double oqk = _oq + k;
+    const double invDenom = 1.0 / (1.0 + k * oqk);
+    const double invN = 1.0 / static_cast<double>(n);
+    kStep = static_cast<T>((k - k0) * invN);
+    oqkStep = static_cast<T>((oqk - oqk0) * invN);
+    invDenomStep = static_cast<T>((invDenom - invDenom0) * invN);
+    return invDenom > 2.0 * invDenom0 || invDenom0 > 2.0 * invDenom;
+  }
+
+  static double getK(double f, double fs) {
+    f = std::max(20.0, std::min(0.9 * fs / 2.0, f));
+    return 2 * FastMath::sin(kPi * f / fs);
+  }
+
+  T _k = 0;
+  T _oqk = 0;
+  T _invDenom = 1;
+  T _kStep = 0;
+  T _oqkStep = 0;
+  T _invDenomStep = 0;
+  double _oq = 1;
+  bool _isSteep = false;
+  T _p1 = 0;
+  T _p2 = 0;
+  T _p3 = 0;
+  T _p4 = 0;
 };
 
-enum class EnvState {
-  kAttack,
-  kDecay,
-  kSustain,
-  kRelease,
-  kStop,
+// Bounds the gain of a StateVariableFilter at frequencies from step (cycles
+// per sample) up, for any cutoff up to f. The filter is the trapezoidal SVF
+// with g = k, whose response is the analog one at r = tan(pi step) / k; past
+// the resonance the lowpass only falls, so pi step <= tan(pi step) keeps it a
+// bound.
+class SvfGainBound {
+public:
+  SvfGainBound(double f, double fs, double q, short type, short iter)
+      : _q(q), _lowpass(type == 0), _squared(iter != 0) {
+    f = std::max(20.0, std::min(0.9 * fs / 2.0, f));
+    _piOverK = kPi / (2 * FastMath::sin(kPi * f / fs));
+    _peak = q > sqrt(0.5) ? q / sqrt(1.0 - 0.25 / (q * q)) : 1.0;
+  }
+
+  double operator()(double step) const {
+    double gain = _peak;
+    const double r = step * _piOverK;
+    if (_lowpass && r > 1)
+      gain = std::min(_peak, 1.0 / hypot(1.0 - r * r, r / _q));
+    return _squared ? gain * gain : gain;
+  }
+
+private:
+  double _q;
+  bool _lowpass;
+  bool _squared;
+  double _piOverK;
+  double _peak;
 };
 
+// An ADSR with a linear attack and linear or exponential decay and release.
+// Each stage is a segment that heads from its start to a target as remain
+// runs down from 1 to 0, see EnvBankLanes, so that voice banks can run it
+// lane by lane with the same arithmetic.
 class InharmonicEnvGen {
 public:
-  void setA(double a, double fs) { _envA = 1.0 / std::max(1.0, 1e-3 * a * fs); }
-  void setD(double d, double fs) { _envD = 1.0 / std::max(1.0, 1e-3 * d * fs); }
-  void setS(double s) { _envS = std::max(0.0, s); }
-  void setR(double r, double fs) { _envR = 1.0 / std::max(1.0, 1e-3 * r * fs); }
+  void setA(double a, double fs) {
+    _envA = 1.0 / std::max(1.0, 1e-3 * a * fs);
+    if (_state == EnvState::kAttack)
+      _step = _envA;
+  }
+  void setD(double d, double fs) {
+    _envD = 1.0 / std::max(1.0, 1e-3 * d * fs);
+    if (_state == EnvState::kDecay)
+      _step = _envD;
+  }
+  void setS(double s) {
+    _envS = std::max(0.0, s);
+    // a running decay heads for the new level, a reached sustain stays
+    if (_state == EnvState::kDecay) {
+      _target = _envS;
+      _span = 1.0 - _envS;
+    }
+  }
+  void setR(double r, double fs) {
+    _envR = 1.0 / std::max(1.0, 1e-3 * r * fs);
+    if (_state == EnvState::kRelease)
+      _step = _envR;
+  }
+  // Bends the decay and release into one-pole curves, 2^curve times as steep
+  // at their start as at their end, 0 keeping them linear.
+  void setCurve(double curve) {
+    _envCurve = std::max(0.0, curve);
+    _envNorm =
+        _envCurve > 0.0 ? 1.0 / (FastMath::exp2(_envCurve) - 1.0) : 0.0;
+  }
   const EnvState &getState() const { return _state; }
+  double getLevel() const { return _last; }
 
   void noteOn() {
-    _state = EnvState::kAttack;
-    _remain = 1.0;
-    _attackBegin = _last;
+    // from wherever the level is, so that a retrigger does not click
+    beginSegment(EnvState::kAttack, _envA, 1.0, _last - 1.0, 0.0, 0.0);
   }
 
   void noteOff() {
     if (_state >= EnvState::kRelease)
       return;
-    _state = EnvState::kRelease;
-    _remain = 1.0;
-    _releaseBegin = _last;
+    beginSegment(EnvState::kRelease, _envR, 0.0, _last, _envCurve, _envNorm);
   }
 
-  bool process(double &env) {
-    switch (_state) {
-    case EnvState::kAttack:
-      _remain -= _envA;
-      if (_remain <= 0.0) {
-        _state = EnvState::kDecay;
-        _remain = 1.0;
-        _last = 1.0;
-      } else {
-        const double t = 1.0 - _remain;
-        _last = _attackBegin + (1.0 - _attackBegin) * t;
-      }
-      env = _last;
-      return false;
+  // Ramps down to silence within n samples, whatever the release time, to
+  // free the voice without a click.
+  void fadeOut(double n) {
+    if (_state == EnvState::kStop)
+      return;
+    beginSegment(EnvState::kFade, 1.0 / std::max(1.0, n), 0.0, _last, 0.0,
+                 0.0);
+  }
 
-    case EnvState::kDecay:
-      _remain -= _envD;
-      if (_remain <= 0.0) {
-        _state = EnvState::kSustain;
-        _remain = 1.0;
-        _last = _envS;
-        _releaseBegin = _envS;
-      } else {
-        _last = _envS + (1.0 - _envS) * _remain;
+  // Silences the envelope at once, for a release that nobody hears anymore.
+  void stop() {
+    beginSegment(EnvState::kStop, 0.0, 0.0, 0.0, 0.0, 0.0);
+    _last = 0.0;
+  }
+
+  // Renders n samples into env and returns how many of them came before the
+  // envelope stopped (n while it keeps running). Each segment is rendered in
+  // closed form up to its end.
+  size_t process(double *env, size_t n) {
+    size_t t = 0;
+    while (t < n) {
+      if (_state == EnvState::kStop) {
+        std::fill(env + t, env + n, 0.0);
+        return t;
       }
-      env = _last;
-      return false;
+      const size_t len = getSegmentLength(n - t);
+      renderSegment(env + t, len);
+      t += len;
+      if (t == n)
+        break;
+      // the sample where remain runs out lands on the target
+      _last = _target;
+      endSegment();
+      if (_state == EnvState::kStop) {
+        std::fill(env + t, env + n, 0.0);
+        return t;
+      }
+      env[t++] = _last;
+    }
+    return n;
+  }
 
-    case EnvState::kSustain:
-      env = _last;
-      return false;
+  // Moves the state into lane l of a bank, with the frozen lane stopping at
+  // sample limit, and back.
+  void storeLane(EnvBankLanes &lanes, size_t l, size_t limit) const {
+    lanes.stage[l] = static_cast<double>(_state);
+    lanes.remain[l] = _remain;
+    lanes.step[l] = _step;
+    lanes.target[l] = _target;
+    lanes.span[l] = _span;
+    lanes.curve[l] = _curve;
+    lanes.norm[l] = _norm;
+    lanes.decayStep[l] = _envD;
+    lanes.decayCurve[l] = _envCurve;
+    lanes.decayNorm[l] = _envNorm;
+    lanes.sustain[l] = _envS;
+    lanes.level[l] = _last;
+    lanes.limit[l] = static_cast<double>(limit);
+  }
+  void loadLane(const EnvBankLanes &lanes, size_t l) {
+    _state = static_cast<EnvState>(static_cast<int>(lanes.stage[l]));
+    _remain = lanes.remain[l];
+    _step = lanes.step[l];
+    _target = lanes.target[l];
+    _span = lanes.span[l];
+    _curve = lanes.curve[l];
+    _norm = lanes.norm[l];
+    _last = lanes.level[l];
+  }
 
-    case EnvState::kRelease:
-      _remain -= _envR;
-      if (_remain <= 0.0) {
-        _state = EnvState::kStop;
-        _remain = 1.0;
-        env = _last = 0.0;
-        return true;
-      } else {
-        env = _last = _releaseBegin * _remain;
-      }
-      return false;
+private:
+  void beginSegment(EnvState state, double step, double target, double span,
+                    double curve, double norm) {
+    _state = state;
+    _remain = 1.0;
+    _step = step;
+    _target = target;
+    _span = span;
+    _curve = curve;
+    _norm = norm;
+  }
 
+  // the same transitions as envBankBody()
+  void endSegment() {
+    switch (_state) {
+    case EnvState::kAttack:
+      beginSegment(EnvState::kDecay, _envD, _envS, 1.0 - _envS, _envCurve,
+                   _envNorm);
+      break;
+    case EnvState::kDecay:
+      beginSegment(EnvState::kSustain, 0.0, _envS, 0.0, 0.0, 0.0);
+      break;
     default:
+      beginSegment(EnvState::kStop, 0.0, 0.0, 0.0, 0.0, 0.0);
       break;
     }
-    env = 0.0;
-    return true;
   }
 
-private:
+  // remain after sample t of the segment, counted from the last render
+  double getRemain(size_t t) const {
+    return _remain - static_cast<double>(t + 1) * _step;
+  }
+
+  // whether the segment runs on past sample t, as in envBankBody()
+  bool isRunning(size_t t) const { return getRemain(t) > 0.5 * _step; }
+
+  // the samples up to n before the segment ends, which it does in one (or
+  // none) of them, as remain only falls
+  size_t getSegmentLength(size_t n) const {
+    if (isRunning(n - 1))
+      return n;
+    // the division can round either way of the sample
+    size_t len = static_cast<size_t>(std::max(0.0, _remain / _step - 1.5));
+    len = std::min(len, n - 1);
+    while (len > 0 && !isRunning(len - 1))
+      len--;
+    while (isRunning(len))
+      len++;
+    return len;
+  }
+
+  void renderSegment(double *env, size_t len) {
+    if (len == 0)
+      return;
+    if (_curve == 0.0) {
+      for (size_t t = 0; t < len; t++)
+        env[t] = _target + _span * getRemain(t);
+    } else {
+      for (size_t t = 0; t < len; t++)
+        env[t] = _target +
+                 _span * ((FastMath::exp2(_curve * getRemain(t)) - 1.0) *
+                          _norm);
+    }
+    _remain -= static_cast<double>(len) * _step;
+    _last = env[len - 1];
+  }
+
   double _envA = 1.0 / (20e-3 * 48000);
   double _envD = 1.0 / (500e-3 * 48000);
   double _envS = 0.8;
   double _envR = 1.0 / (1500e-3 * 48000);
+  double _envCurve = 0;
+  double _envNorm = 0;
   EnvState _state = EnvState::kStop;
   double _remain = 1;
-  double _attackBegin = 0;
-  double _releaseBegin = 0;
+  double _step = 0;
+  double _target = 0;
+  double _span = 0;
+  double _curve = 0;
+  double _norm = 0;
   double _last = 0;
 };
 
@@ -259,16 +915,16 @@ public:
     _phase = 0.25;
   }
 
-  double process(double delay, double step) {
-    double out = 0.0;
-    if (_remain > 0.0) {
+  // Moves n samples ahead and returns the value there.
+  double advance(size_t n, double delay, double step) {
+    size_t t = 0;
+    for (; t < n && _remain > 0.0; t++)
       _remain -= delay;
-    } else {
-      out = unsafeFastCos2pi(_phase);
-      _phase += step;
-      _phase -= static_cast<int>(_phase);
-    }
-    return out;
+    if (t == n)
+      return 0.0;
+    _phase += step * static_cast<double>(n - t);
+    _phase -= static_cast<int>(_phase);
+    return interpolatedCos2pi(_phase);
   }
 
 private:
@@ -276,25 +932,51 @@ private:
   double _phase = 0.0;
 };
 
-class InharmonicVoice {
+template <typename T> class InharmonicVoice {
 public:
-  void setSampleRate(double fs) { _fs = std::max(8000.0, fs); }
+  InharmonicVoice() {
+    _osc.setMix(_mixOsc1, _mixOsc2);
+    _osc.setCeiling(kAudibleCeiling / _fs);
+  }
+
+  // The cache is shared by all voices of a synth and must outlive them.
+  void setRatioCache(PartialRatioCache *cache) { _ratioCache = cache; }
+  // likewise, and built for the sample rate of the voice
+  void setCutoffTable(const SvfCutoffTable *table) { _cutoffTable = table; }
+  void setSampleRate(double fs) {
+    _fs = std::max(8000.0, fs);
+    _osc.setCeiling(kAudibleCeiling / _fs);
+  }
   void setOscMix(double mix) {
     mix = std::max(0.0, std::min(1.0, mix));
     _mixOsc1 = 1.0 - mix;
     _mixOsc2 = mix;
+    _osc.setMix(_mixOsc1, _mixOsc2);
   }
-  void setInharmonicB(double b) {
+  // Sets the inharmonicity of the first oscillator and that of the second
+  // relative to it, with one retune for both.
+  void setInharmonic(double b, double subscale) {
     _inharmonicB1 = std::max(0.0, b);
+    _inharmonicSubscale = std::max(0.0, subscale);
     _inharmonicB2 = _inharmonicB1 * _inharmonicSubscale;
-    updateOscFreq();
+    // a stopped voice picks the ratios up at its next note-on
+    if (_envAmp.getState() != EnvState::kStop)
+      updateOscFreq();
+    if (_hasPendingNote)
+      resolvePendingRatios();
   }
-  void setInharmonicSubscale(double s) {
-    _inharmonicSubscale = std::max(0.0, s);
-    _inharmonicB2 = _inharmonicB1 * _inharmonicSubscale;
-    updateOscFreq();
+  void setInharmKeyFollow(double x) {
+    _inharmKeyFollow = x;
+    if (_hasPendingNote)
+      resolvePendingRatios();
+  }
+  void setOscMode(OscMode mode) {
+    if (_oscMode == mode)
+      return;
+    _oscMode = mode;
+    _osc.setMode(mode);
+    _spectral.reset();
   }
-  void setInharmKeyFollow(double x) { _inharmKeyFollow = x; }
   void setAmpVeloSens(double x) { _ampVeloSens = x; }
   void setVibDelay(double x) { _vibDelay = x; }
   void setVibDepth(double x) { _vibDepth = x; }
@@ -303,103 +985,444 @@ public:
     _filtType = type % 3;
     _filtIter = type / 3;
   }
-  void setFilterFreq(double freq) {
+  // sets the cutoff and the resonance, with one coefficient update for both
+  void setFilter(double freq, double q) {
     _filtFreq = freq;
-    _svf.setFreq(_filtFreq, _fs, _filtQ);
-  }
-  void setFilterQ(double q) {
+    _filtLog2Freq = std::log2(std::max(1.0, freq));
     _filtQ = q;
-    _svf.setFreq(_filtFreq, _fs, _filtQ);
+    _svf.setQ(q);
+    updateFilter();
   }
   void setFilterEnvAmount(double amount) { _filtEnvAmount = amount; }
   void setFiltKeyFollow(double x) { _filtKeyFollow = x; }
   short getPitch() const { return _pitch; }
+  // the output gain the note has reached
+  double getLevel() const {
+    const double amp = _envAmp.getLevel() * _ampVelMod;
+    return amp * amp;
+  }
+  bool isReleased() const { return _envAmp.getState() == EnvState::kRelease; }
+  // not sounding and no note waiting to start
+  bool isStopped() const {
+    return _envAmp.getState() == EnvState::kStop && !_hasPendingNote;
+  }
   InharmonicEnvGen &getEnvAmp() { return _envAmp; }
   InharmonicEnvGen &getEnvFilt() { return _envFilt; }
 
   void noteOn(short pitch, double velocity, bool isRandomPhase) {
-    _pitch = std::max((short)0, std::min((short)127, pitch));
-    _freq = 440.0 * exp2((_pitch - 69.0) / 12.0) / _fs;
-    _velocity = velocity;
-    if (isRandomPhase) {
-      _osc1.resetStateRandom();
-      _osc2.resetStateRandom();
-    } else {
-      _osc1.resetStateZero();
-      _osc2.resetStateZero();
-    }
+    resetNote(pitch, velocity, isRandomPhase);
     updateOscFreq();
-    _svf.setFreq(_filtFreq, _fs, _filtQ);
-    _envAmp.noteOn();
-    _envFilt.noteOn();
-    _lfoVib.noteOn();
-
-    _ampVelMod = (_velocity - 1.0) * _ampVeloSens + 1.0;
-    _filtKeyMod = exp2(((_pitch - 60.0) / 12.0) * _filtKeyFollow);
+    startEnvelopes();
   }
 
   void noteOff() {
+    if (_hasPendingNote) {
+      _isPendingNoteHeld = false;
+      return;
+    }
     _envAmp.noteOff();
     _envFilt.noteOff();
   }
 
-  void setFreqBend(double x) {
+  // Fades the sounding note out within kDeclickTime and starts the given one
+  // where the fade ends, so that taking the voice over does not click.
+  void steal(short pitch, double velocity, bool isRandomPhase) {
+    if (_envAmp.getState() == EnvState::kStop) {
+      _hasPendingNote = false;
+      noteOn(pitch, velocity, isRandomPhase);
+      return;
+    }
+    _hasPendingNote = true;
+    _isPendingNoteHeld = true;
+    _pendingPitch = std::max((short)0, std::min((short)127, pitch));
+    _pendingVelocity = velocity;
+    _isPendingRandomPhase = isRandomPhase;
+    resolvePendingRatios();
+    _envAmp.fadeOut(1e-3 * kDeclickTime * _fs);
+  }
+
+  // Fades the voice out within kDeclickTime for good.
+  void fadeOut() {
+    _hasPendingNote = false;
+    _envAmp.fadeOut(1e-3 * kDeclickTime * _fs);
+  }
+
+  // Sets the bend, retuning a sounding voice unless a retune follows anyway.
+  void setFreqBend(double x, bool isRetuned = true) {
     _freqBend = x;
-    _osc1.setFreq(_freq * _freqBend, _inharmonicB1);
-    _osc2.setFreq(_freq * _freqBend, _inharmonicB2);
+    // a stopped voice picks the bend up at its next note-on
+    if (isRetuned && _envAmp.getState() != EnvState::kStop)
+      _osc.setFreq(_freq * _freqBend);
+  }
+
+  // Adds n <= kMaxBlockSize samples of this voice to out.
+  void process(T *out, size_t n) {
+    const size_t count = render(out, n);
+    startPendingNote(out, count, n);
+  }
+
+  // Adds n <= kMaxBlockSize samples of each of the m <= kVoiceBankLanes voices
+  // to out[i], exactly as their process() would, but with the envelopes and
+  // filters running side by side as a voice bank. The voices add in order, so
+  // they may share an output.
+  static void processBank(InharmonicVoice *const *voices, T *const *out,
+                          size_t m, size_t n) {
+    const VoiceBankKernels<T> &kernels = getVoiceBankKernels<T>();
+    alignas(kVoiceBankAlign) double env[kMaxBlockSize * kVoiceBankLanes];
+    double a[kVoiceBankLanes][kMaxBlockSize];
+    double f[kVoiceBankLanes][kMaxBlockSize];
+    size_t count[kVoiceBankLanes];
+
+    // amp, then freq up to where each amp stopped
+    EnvBankLanes envLanes;
+    for (size_t l = 0; l < m; l++)
+      voices[l]->_envAmp.storeLane(envLanes, l, n);
+    kernels.env(envLanes, env, n);
+    for (size_t l = 0; l < m; l++) {
+      voices[l]->_envAmp.loadLane(envLanes, l);
+      count[l] = static_cast<size_t>(envLanes.count[l]);
+      deinterleave(env, l, a[l], count[l]);
+      voices[l]->_envFilt.storeLane(envLanes, l, count[l]);
+    }
+    kernels.env(envLanes, env, n);
+    for (size_t l = 0; l < m; l++) {
+      voices[l]->_envFilt.loadLane(envLanes, l);
+      deinterleave(env, l, f[l], count[l]);
+    }
+
+    // vco, with the voices that stop within the block filtering on their
+    // own, as the lanes share their control intervals
+    T vco[kVoiceBankLanes][kMaxBlockSize];
+    size_t rendered[kVoiceBankLanes];
+    bool isAudible[kVoiceBankLanes];
+    bool isBanked[kVoiceBankLanes];
+    size_t numBanked = 0;
+    size_t first = 0;
+    for (size_t l = 0; l < m; l++) {
+      InharmonicVoice &voice = *voices[l];
+      isAudible[l] = count[l] > 0 && voice.renderOsc(vco[l], a[l], f[l],
+                                                      count[l]);
+      rendered[l] = count[l];
+      if (count[l] > 0 && !isAudible[l])
+        rendered[l] =
+            voice._envAmp.getState() == EnvState::kStop ? 0 : count[l];
+      isBanked[l] = isAudible[l] && count[l] == n;
+      if (isAudible[l] && !isBanked[l])
+        voice.filter(vco[l], f[l], count[l]);
+      if (isBanked[l] && numBanked++ == 0)
+        first = l;
+    }
+
+    // vcf
+    if (numBanked > 0) {
+      SvfBankLanes<T> svfLanes;
+      alignas(kVoiceBankAlign) T x[kMaxBlockSize * kVoiceBankLanes] = {};
+      for (size_t l = 0; l < m; l++) {
+        if (!isBanked[l])
+          continue;
+        voices[l]->_svf.storeLane(svfLanes, l);
+        for (size_t t = 0; t < n; t++)
+          x[t * kVoiceBankLanes + l] = vco[l][t];
+      }
+      const short type = voices[first]->_filtType;
+      const bool iter = voices[first]->_filtIter != 0;
+      bool isRamp = false;
+      for (size_t l = 0; l < m; l++)
+        isRamp |= isBanked[l] && voices[l]->isFilterModulated();
+      if (isRamp) {
+        for (size_t t = 0; t < n;) {
+          const size_t len = std::min(kControlInterval, n - t);
+          bool isSteep = false;
+          for (size_t l = 0; l < m; l++) {
+            InharmonicVoice &voice = *voices[l];
+            if (!isBanked[l] || !voice.isFilterModulated())
+              continue;
+            const double k = voice.getFilterTarget(f[l], t + len);
+            voice._svf.rampLane(svfLanes, l, k, len);
+            isSteep |= svfLanes.steep[l] != 0;
+          }
+          kernels.svf(svfLanes, x + t * kVoiceBankLanes, len, type, iter, true,
+                      isSteep);
+          t += len;
+        }
+      } else {
+        kernels.svf(svfLanes, x, n, type, iter, false, false);
+      }
+      for (size_t l = 0; l < m; l++) {
+        if (!isBanked[l])
+          continue;
+        voices[l]->_svf.loadLane(svfLanes, l);
+        deinterleave(x, l, vco[l], n);
+      }
+    }
+
+    for (size_t l = 0; l < m; l++) {
+      if (isAudible[l])
+        voices[l]->addAmp(out[l], vco[l], a[l], count[l]);
+      voices[l]->startPendingNote(out[l], rendered[l], n);
+    }
   }
 
-  double process() {
+private:
+  template <typename U>
+  static void deinterleave(const U *x, size_t l, U *lane, size_t n) {
+    for (size_t t = 0; t < n; t++)
+      lane[t] = x[t * kVoiceBankLanes + l];
+  }
+
+  // Adds up to n samples to out and returns how many came before the note
+  // stopped (n while it keeps sounding).
+  size_t render(T *out, size_t n) {
     // amp
-    double a = 0.0;
-    if (_envAmp.process(a))
-      return 0.0;
-    a *= _ampVelMod;
+    double a[kMaxBlockSize];
+    n = _envAmp.process(a, n);
+    if (n == 0)
+      return 0;
 
     // freq
-    double f = 0.0;
-    _envFilt.process(f);
+    double f[kMaxBlockSize];
+    _envFilt.process(f, n);
+
+    T vco[kMaxBlockSize];
+    if (!renderOsc(vco, a, f, n))
+      return _envAmp.getState() == EnvState::kStop ? 0 : n;
+    filter(vco, f, n);
+    addAmp(out, vco, a, n);
+    return n;
+  }
+
+  // If the stolen note has faded out at sample count, starts the next one
+  // right there and adds it up to sample n. This may run on a render thread,
+  // so the shared ratio cache is only read, and a ratio evicted since the
+  // steal is computed here.
+  void startPendingNote(T *out, size_t count, size_t n) {
+    if (!_hasPendingNote || _envAmp.getState() != EnvState::kStop)
+      return;
+    _hasPendingNote = false;
+    resetNote(_pendingPitch, _pendingVelocity, _isPendingRandomPhase);
+    PartialRatios evicted;
+    for (size_t osc = 0; osc < 2; osc++) {
+      const PartialRatios *ratios = _ratioCache->find(_pendingB[osc]);
+      if (ratios == nullptr) {
+        PartialRatioCache::compute(_pendingB[osc], evicted);
+        ratios = &evicted;
+      }
+      _osc.setRatios(osc, *ratios);
+    }
+    _osc.setFreq(_freq * _freqBend);
+    startEnvelopes();
+    if (!_isPendingNoteHeld)
+      noteOff();
+    render(out + count, n - count);
+  }
+
+  // Renders the oscillators into vco for the envelopes a and f. Returns false
+  // if nobody would hear the block, in which case a release has been stopped.
+  bool renderOsc(T *vco, const double *a, const double *f, size_t n) {
+    // In release (or a fade) the amp only falls and the filter envelope only
+    // heads for zero, so the bounds of this block hold for the rest of the
+    // note.
+    const bool isReleased = _envAmp.getState() >= EnvState::kRelease;
+    bool isAudible;
+    if (_oscMode == OscMode::kIfft) {
+      // a frame reaches two hops ahead, past this block's envelopes
+      const double envMod = FastMath::exp2(std::max(0.0, _filtEnvAmount));
+      isAudible = cullPartials(isReleased ? a[0] : 1.0,
+                               _filtFreq * _filtKeyMod * envMod);
+    } else {
+      double ampPeak = 0;
+      // the cutoff ramps from the last control point of the previous block
+      double filtPeak = std::max(0.0, _filtEnvRamped * _filtEnvAmount);
+      for (size_t t = 0; t < n; t++) {
+        ampPeak = std::max(ampPeak, a[t]);
+        filtPeak = std::max(filtPeak, f[t] * _filtEnvAmount);
+      }
+      isAudible = cullPartials(
+          ampPeak, _filtFreq * _filtKeyMod * FastMath::exp2(filtPeak));
+    }
+    if (!isAudible) {
+      // drop the filter state too rather than ring it out into denormals
+      _svf.resetState();
+      _spectral.reset();
+      // and retire a release tail that stays silent to its end
+      if (isReleased) {
+        _envAmp.stop();
+        _envFilt.stop();
+      }
+      return false;
+    }
 
     // vco
-    double oscMod = 1.0;
+    T oscMod[kMaxBlockSize];
     if (_vibDepth != 0.0) {
-      // vibrato
+      // vibrato, evaluated at the end of each control interval and
+      // interpolated up to there
       const double del = 1.0 / (1e-3 * _vibDelay * _fs);
       const double step = _vibSpeed / _fs;
-      oscMod *= exp2(_vibDepth * _lfoVib.process(del, step) / 1200.0);
+      for (size_t t = 0; t < n;) {
+        const size_t len = std::min(kControlInterval, n - t);
+        const double lfo = _lfoVib.advance(len, del, step);
+        const double target = FastMath::exp2(_vibDepth * lfo / 1200.0);
+        const double delta = (target - _vibMod) / static_cast<double>(len);
+        if (_oscMode == OscMode::kPhasor) {
+          // the phasors rebuild their rotors at each change of the scale,
+          // so they hold the mean of the ramp, which ends on the same phase
+          const T mod = static_cast<T>(_vibMod + delta * 0.5 * (len + 1));
+          std::fill(oscMod + t, oscMod + t + len, mod);
+        } else {
+          for (size_t i = 0; i < len; i++)
+            oscMod[t + i] = static_cast<T>(_vibMod + delta * (i + 1));
+        }
+        _vibMod = target;
+        t += len;
+      }
+    } else {
+      std::fill(oscMod, oscMod + n, static_cast<T>(1));
+      _vibMod = 1.0;
     }
-    const double out1 = _osc1.process(oscMod);
-    const double out2 = _osc2.process(oscMod);
-    const double vco = out1 * _mixOsc1 + out2 * _mixOsc2;
+    if (_oscMode == OscMode::kIfft) {
+      // one inverse FFT per hop, however many partials the voice has
+      size_t t = 0;
+      while (t < n) {
+        if (_spectral.needsFrame()) {
+          _spectral.beginFrame();
+          _osc.addFrame(_spectral, oscMod[t]);
+          _spectral.endFrame();
+        }
+        t += _spectral.read(vco + t, n - t);
+      }
+    } else {
+      _osc.process(vco, oscMod, n);
+    }
+    return true;
+  }
 
-    // vcf
-    bool isFiltModified = false;
-    double filtMod = 1.0;
-    if (_filtEnvAmount != 0.0) {
-      // filter envelope
-      filtMod *= exp2(f * _filtEnvAmount);
-      isFiltModified = true;
+  void filter(T *vco, const double *f, size_t n) {
+    if (isFilterModulated()) {
+      // filter envelope and key follow, at the end of each control
+      // interval, with the coefficients moving there in equal steps
+      for (size_t t = 0; t < n;) {
+        const size_t len = std::min(kControlInterval, n - t);
+        _svf.rampK(getFilterTarget(f, t + len), len);
+        _svf.processRamp(vco + t, len, _filtType, _filtIter);
+        t += len;
+      }
+    } else {
+      _svf.process(vco, n, _filtType, _filtIter);
     }
-    if (_filtKeyFollow != 0.0) {
-      // filter velocity
-      filtMod *= _filtKeyMod;
-      isFiltModified = true;
+  }
+
+  bool isFilterModulated() const {
+    return _filtEnvAmount != 0.0 || _filtKeyFollow != 0.0;
+  }
+
+  // the filter coefficient k for the control point at sample end - 1 of the
+  // filter envelope f
+  double getFilterTarget(const double *f, size_t end) {
+    _filtEnvRamped = f[end - 1];
+    const double log2Cutoff =
+        _filtLog2Freq + _filtKeyLog2 + _filtEnvRamped * _filtEnvAmount;
+    return _cutoffTable->getK(log2Cutoff);
+  }
+
+  void addAmp(T *out, const T *vco, const double *a, size_t n) const {
+    for (size_t t = 0; t < n; t++) {
+      const double amp = a[t] * _ampVelMod;
+      out[t] += static_cast<T>(amp * amp) * vco[t];
     }
-    if (isFiltModified) {
-      _svf.setFreq(_filtFreq * filtMod, _fs, _filtQ);
+  }
+
+  // Drops the partials nobody could hear from the render loop, from the top
+  // down as many as keep their summed peak level at the output below
+  // kCullLevel, given the loudest amp envelope and filter cutoff ahead.
+  // Partials rejoin as the bound rises. Returns false if none is left.
+  bool cullPartials(double ampPeak, double cutoffPeak) {
+    const double amp = ampPeak * _ampVelMod;
+    const double modPeak = FastMath::exp2(_vibDepth / 1200.0);
+    const double gain = amp * amp;
+    const SvfGainBound filtGain(cutoffPeak, _fs, _filtQ, _filtType,
+                                _filtIter);
+    size_t count = _osc.getNumPartials();
+
+    // whole kernel lanes at a time, bounding the filter by the lowest
+    // partial of each, as the gain only falls above the resonance
+    double dropped = 0;
+    while (count > 0) {
+      const size_t begin = (count - 1) / kPartialBankLanes * kPartialBankLanes;
+      double sum = 0;
+      for (size_t i = begin; i < count; i++)
+        sum += _osc.getPartialAmp(i);
+      dropped += gain * sum * filtGain(_osc.getPartialStep(begin) * modPeak);
+      if (dropped >= kCullLevel)
+        break;
+      count = begin;
     }
-    double vcf = _svf.process(vco, _filtType, _filtIter);
+    _osc.setActivePartials(count);
+    return count > 0;
+  }
 
-    return a * a * vcf;
+  void updateFilter() {
+    // a modulated cutoff heads for the new one over the next interval instead
+    if (!isFilterModulated())
+      _svf.setFreq(_filtFreq, _fs, _filtQ);
+  }
+
+  // the note-on up to the partial ratios, which the callers set
+  void resetNote(short pitch, double velocity, bool isRandomPhase) {
+    _pitch = std::max((short)0, std::min((short)127, pitch));
+    _freq = 440.0 * FastMath::exp2((_pitch - 69.0) / 12.0) / _fs;
+    _velocity = velocity;
+    if (isRandomPhase) {
+      _osc.resetStateRandom();
+    } else {
+      _osc.resetStateZero();
+    }
+    _spectral.reset();
+  }
+
+  // the note-on after the partial ratios
+  void startEnvelopes() {
+    _ampVelMod = (_velocity - 1.0) * _ampVeloSens + 1.0;
+    _filtKeyLog2 = ((_pitch - 60.0) / 12.0) * _filtKeyFollow;
+    _filtKeyMod = FastMath::exp2(_filtKeyLog2);
+    _svf.setFreq(_filtFreq * _filtKeyMod, _fs, _filtQ);
+    _envAmp.noteOn();
+    _envFilt.noteOn();
+    _lfoVib.noteOn();
+
+    _vibMod = 1.0;
+    _filtEnvRamped = 0;
+  }
+
+  double getInharmKeyMod(short pitch) const {
+    return FastMath::exp2((pitch - 60.0) / 12.0 * 4.0 * _inharmKeyFollow);
   }
 
-private:
   void updateOscFreq() {
-    double inharmKeyMod = exp2((_pitch - 60.0) / 12.0 * 4.0 * _inharmKeyFollow);
-    _osc1.setFreq(_freq * _freqBend, _inharmonicB1 * inharmKeyMod);
-    _osc2.setFreq(_freq * _freqBend, _inharmonicB2 * inharmKeyMod);
+    const double inharmKeyMod = getInharmKeyMod(_pitch);
+    // one at a time, as the second lookup may evict the first
+    _osc.setRatios(0, _ratioCache->get(_inharmonicB1 * inharmKeyMod));
+    _osc.setRatios(1, _ratioCache->get(_inharmonicB2 * inharmKeyMod));
+    _osc.setFreq(_freq * _freqBend);
   }
 
+  // Takes the inharmonicities of the pending note and caches their ratios,
+  // on the audio thread, for startPendingNote().
+  void resolvePendingRatios() {
+    const double inharmKeyMod = getInharmKeyMod(_pendingPitch);
+    _pendingB[0] = _inharmonicB1 * inharmKeyMod;
+    _pendingB[1] = _inharmonicB2 * inharmKeyMod;
+    _ratioCache->get(_pendingB[0]);
+    _ratioCache->get(_pendingB[1]);
+  }
+
+  // nobody hears partials above this, whatever the sample rate
+  static constexpr double kAudibleCeiling = 20000.0;
+  // -100 dB, the most all culled partials of a voice may add up to
+  static constexpr double kCullLevel = 1e-5;
+  // ms a stolen voice takes to fade out
+  static constexpr double kDeclickTime = 5.0;
+
   double _fs = 48000;
   short _pitch = 69;
   double _freq = 440.0 / 48000.0;
@@ -407,6 +1430,7 @@ private:
   double _velocity = 1.0;
   double _ampVelMod = 1.0;
   double _filtKeyMod = 1.0;
+  double _filtKeyLog2 = 0.0;
 
   double _mixOsc1 = 0.7;
   double _mixOsc2 = 0.3;
@@ -421,72 +1445,175 @@ private:
   short _filtType = 0;
   short _filtIter = 0;
   double _filtFreq = 4000;
+  double _filtLog2Freq = std::log2(4000.0);
   double _filtQ = 0.5;
   double _filtEnvAmount = 0.0;
   double _filtKeyFollow = 0.0;
-
-  InharmonicOscillator _osc1;
-  InharmonicOscillator _osc2;
+  OscMode _oscMode = OscMode::kTable;
+
+  // the modulation as of the last control point
+  double _vibMod = 1.0;
+  double _filtEnvRamped = 0;
+
+  // the note that starts once a stolen voice has faded out
+  bool _hasPendingNote = false;
+  bool _isPendingNoteHeld = false;
+  bool _isPendingRandomPhase = false;
+  short _pendingPitch = 0;
+  double _pendingVelocity = 0;
+  // its inharmonicities, key followed
+  double _pendingB[2] = {};
+
+  PartialRatioCache *_ratioCache = nullptr;
+  const SvfCutoffTable *_cutoffTable = nullptr;
+  InharmonicOscillator<T> _osc;
+  SpectralPartialBank<T> _spectral;
   InharmonicEnvGen _envAmp;
   InharmonicEnvGen _envFilt;
   InharmonicLFO _lfoVib;
-  StateVariableFilter _svf;
+  StateVariableFilter<T> _svf;
+};
+
+// Which voice a note takes over when all of them are sounding.
+enum class VoiceSteal {
+  // the oldest released note, else the oldest held one
+  kOldest,
+  // the note that has faded the most
+  kQuietest,
+  // as kOldest, but a key struck again always takes its own voice over
+  kSamePitch,
 };
 
-class InharmonicSynth {
+template <typename T> class InharmonicSynth {
 public:
+  // the most voices setMaxPolyphony() allocates, about 5 MB of voice state
+  // in double and 3 MB in float
+  static constexpr size_t kMaxVoices = 128;
+
+  InharmonicSynth() {
+    std::fill(_pitchHead, _pitchHead + kNumPitches, kNoVoice);
+    setMaxPolyphony(_polyphony);
+  }
+
   void noteOn(short channel, short pitch, double velocity) {
-    // find stopped notes
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      if (_voices[i].getEnvAmp().getState() == EnvState::kStop) {
-        _voices[i].noteOn(pitch, velocity, _isRandomPhase);
-        return;
+    pitch = std::max((short)0, std::min((short)(kNumPitches - 1), pitch));
+    if (_voiceSteal == VoiceSteal::kSamePitch) {
+      for (size_t i = _pitchHead[pitch]; i != kNoVoice; i = _nextOfPitch[i]) {
+        if (i < _polyphony) {
+          stealVoice(i, pitch, velocity);
+          return;
+        }
       }
     }
 
-    // find released notes
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      if (_voices[i].getEnvAmp().getState() == EnvState::kRelease) {
-        _voices[i].noteOn(pitch, velocity, _isRandomPhase);
-        return;
-      }
+    if (_numFree > 0) {
+      const size_t i = _free[--_numFree];
+      if (_voiceParamsVersion[i] != _paramsVersion)
+        applyParams(i);
+      _voices[i].noteOn(pitch, velocity, _isRandomPhase);
+      _voiceAge[i] = _noteCount++;
+      linkPitch(i, pitch);
+      activate(i);
+      return;
     }
+
+    stealVoice(findVictim(), pitch, velocity);
   }
 
   void noteOff(short channel, short pitch, double velocity) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      if (_voices[i].getPitch() == pitch) {
-        _voices[i].noteOff();
-      }
-    }
+    if (pitch < 0 || pitch >= kNumPitches)
+      return;
+    for (size_t i = _pitchHead[pitch]; i != kNoVoice; i = _nextOfPitch[i])
+      _voices[i].noteOff();
   }
 
+  // no voice sounding or waiting to start, so that process() renders zeros
+  bool isSilent() const { return _numActive == 0; }
+
   void allNoteOff() {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].noteOff();
+    for (size_t k = 0; k < _numActive; k++) {
+      _voices[_active[k]].noteOff();
     }
   }
 
-  void process64(double &outL, double &outR) {
-    double outVoice = 0;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      outVoice += _voices[i].process();
+  void process(T *outL, T *outR, size_t n) {
+    applyDeferred();
+    if (_renderPool != nullptr && _renderPool->getNumThreads() > 1 &&
+        _numActive > 1 && n >= kMinParallelBlockSize && _voiceBufferSize > 0) {
+      processParallel(outL, outR, n);
+    } else {
+      const T outVolume = static_cast<T>(_outVolume);
+      for (size_t offset = 0; offset < n; offset += kMaxBlockSize) {
+        const size_t len = std::min(kMaxBlockSize, n - offset);
+        T out[kMaxBlockSize] = {};
+        // every voice adds into the same buffer
+        T *outs[kVoiceBankLanes];
+        for (size_t i = 0; i < kVoiceBankLanes; i++)
+          outs[i] = out;
+        for (size_t k = 0; k < _numActive; k += kVoiceBankLanes)
+          processBank(k, std::min(kVoiceBankLanes, _numActive - k), outs, len);
+        for (size_t t = 0; t < len; t++) {
+          outL[offset + t] = outR[offset + t] = out[t] * outVolume;
+        }
+      }
     }
-    outVoice *= _outVolume;
-    outL = outVoice;
-    outR = outVoice;
+    retireStoppedVoices();
   }
 
-  void process32(float &outL, float &outR) {
-    double outL64, outR64;
-    process64(outL64, outR64);
-    outL = static_cast<float>(outL64);
-    outR = static_cast<float>(outR64);
+  // Sounds at most n voices at once, up to the voices setMaxPolyphony()
+  // allocated. Voices above a lowered limit fade out.
+  void setPolyphony(size_t n) {
+    n = std::max<size_t>(1, std::min(_voices.size(), n));
+    if (n == _polyphony)
+      return;
+    _polyphony = n;
+    resetFreeVoices();
+    for (size_t k = 0; k < _numActive; k++) {
+      if (_active[k] >= _polyphony)
+        _voices[_active[k]].fadeOut();
+    }
+  }
+  void setVoiceSteal(VoiceSteal x) { _voiceSteal = x; }
+
+  // Allocates the voices, and the buffers of the parallel path, for at most n
+  // notes at once, and lowers the polyphony to n if above. A new number of
+  // voices silences them all. Allocates, so call it outside of processing.
+  void setMaxPolyphony(size_t n) {
+    n = std::max<size_t>(1, std::min(kMaxVoices, n));
+    if (n != _voices.size()) {
+      std::vector<InharmonicVoice<T>>(n).swap(_voices);
+      for (size_t i = 0; i < n; i++) {
+        _voices[i].setRatioCache(&_ratioCache);
+        _voices[i].setCutoffTable(&_cutoffTable);
+        _voices[i].setSampleRate(_fs);
+        applyParams(i);
+      }
+      _numActive = 0;
+      std::fill(_pitchHead, _pitchHead + kNumPitches, kNoVoice);
+      _voiceBuffers.assign(n * _voiceBufferSize, static_cast<T>(0));
+    }
+    _polyphony = std::min(_polyphony, n);
+    resetFreeVoices();
+  }
+
+  // Renders the voices on the pool's threads when it has any and the block is
+  // long enough to be worth splitting. One pool can serve several synths
+  // that never process at the same time.
+  void setRenderPool(RenderPool *pool) { _renderPool = pool; }
+
+  // Sizes the per-voice buffers of the parallel path, which renders at most n
+  // samples at a time. Allocates, so call it outside of processing.
+  void setMaxBlockSize(size_t n) {
+    // whole cache lines per voice, so that no two threads share one
+    _voiceBufferSize = (n + 15) / 16 * 16;
+    _voiceBuffers.assign(_voices.size() * _voiceBufferSize,
+                         static_cast<T>(0));
   }
 
   void setSampleRate(double fs) {
     _fs = fs;
-    for (size_t i = 0; i < kMaxVoices; i++) {
+    _cutoffTable.setSampleRate(fs);
+    for (size_t i = 0; i < _voices.size(); i++) {
       _voices[i].setSampleRate(fs);
       _voices[i].getEnvAmp().setA(_ampEnvA, _fs);
       _voices[i].getEnvAmp().setD(_ampEnvD, _fs);
@@ -500,10 +1627,8 @@ public:
   void setVolume(double value) { _volume = value; }
   void setExpression(double value) { _expression = value; }
   void setPitchBend(double value) {
-    const double freqBend = exp2(_bendRange * value / 12.0);
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setFreqBend(freqBend);
-    }
+    _freqBend = FastMath::exp2(_bendRange * value / 12.0);
+    deferVoices(kDeferredBend);
   }
   void setModWheel(double value) { _modwheel = value; }
   void setSustainPedal(bool value) { _sustainPedal = value; }
@@ -512,119 +1637,324 @@ public:
 
   void setOutVol(double value) { _outVolume = value; }
   void setOscMix(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setOscMix(x);
-    }
+    _oscMix = x;
+    deferVoices(kDeferredOscMix);
   }
   void setIsRandomPhase(bool x) { _isRandomPhase = x; }
+  void setOscMode(OscMode x) {
+    _oscMode = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.setOscMode(x); });
+  }
   void setInharmonic(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setInharmonicB(x);
-    }
+    _inharmonic = x;
+    deferVoices(kDeferredInharmonic);
   }
   void setInharmonicSubscale(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setInharmonicSubscale(x);
-    }
+    _inharmonicSubscale = x;
+    deferVoices(kDeferredInharmonic);
   }
   void setInharmKeyFollow(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setInharmKeyFollow(x);
-    }
+    _inharmKeyFollow = x;
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.setInharmKeyFollow(x); });
   }
   void setAmpEnvA(double x) {
     _ampEnvA = x;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvAmp().setA(_ampEnvA, _fs);
-    }
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvAmp().setA(x, _fs); });
   }
   void setAmpEnvD(double x) {
     _ampEnvD = x;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvAmp().setD(_ampEnvD, _fs);
-    }
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvAmp().setD(x, _fs); });
   }
   void setAmpEnvS(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvAmp().setS(x);
-    }
+    _ampEnvS = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.getEnvAmp().setS(x); });
   }
   void setAmpEnvR(double x) {
     _ampEnvR = x;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvAmp().setR(_ampEnvR, _fs);
-    }
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvAmp().setR(x, _fs); });
+  }
+  // applies to the decays and releases the envelopes start from now on
+  void setEnvCurve(double x) {
+    _envCurve = x;
+    updateVoices([&](InharmonicVoice<T> &voice) {
+      voice.getEnvAmp().setCurve(x);
+      voice.getEnvFilt().setCurve(x);
+    });
   }
   void setAmpVeloSens(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setAmpVeloSens(x);
-    }
+    _ampVeloSens = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.setAmpVeloSens(x); });
   }
   void setVibDelay(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setVibDelay(x);
-    }
+    _vibDelay = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.setVibDelay(x); });
   }
   void setVibDepth(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setVibDepth(x);
-    }
+    _vibDepth = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.setVibDepth(x); });
   }
   void setVibSpeed(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setVibSpeed(x);
-    }
+    _vibSpeed = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.setVibSpeed(x); });
   }
   void setFiltType(short x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setFilterType(x);
-    }
+    _filtType = x;
+    updateVoices([&](InharmonicVoice<T> &voice) { voice.setFilterType(x); });
   }
   void setFiltCutoff(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setFilterFreq(x);
-    }
+    _filtCutoff = x;
+    deferVoices(kDeferredFilter);
   }
   void setFiltReso(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setFilterQ(x);
-    }
+    _filtReso = x;
+    deferVoices(kDeferredFilter);
   }
   void setFiltEnvAmount(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setFilterEnvAmount(x);
-    }
+    _filtEnvAmount = x;
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.setFilterEnvAmount(x); });
   }
   void setFiltEnvA(double x) {
     _filtEnvA = x;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvFilt().setA(_filtEnvA, _fs);
-    }
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvFilt().setA(x, _fs); });
   }
   void setFiltEnvD(double x) {
     _filtEnvD = x;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvFilt().setD(_filtEnvD, _fs);
-    }
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvFilt().setD(x, _fs); });
   }
   void setFiltEnvS(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvFilt().setS(x);
-    }
+    _filtEnvS = x;
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvFilt().setS(x); });
   }
   void setFiltEnvR(double x) {
     _filtEnvR = x;
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].getEnvFilt().setR(_filtEnvR, _fs);
-    }
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.getEnvFilt().setR(x, _fs); });
   }
   void setFiltKeyFollow(double x) {
-    for (size_t i = 0; i < kMaxVoices; i++) {
-      _voices[i].setFiltKeyFollow(x);
-    }
+    _filtKeyFollow = x;
+    updateVoices(
+        [&](InharmonicVoice<T> &voice) { voice.setFiltKeyFollow(x); });
   }
 
 private:
+  // Applies a parameter change to the sounding voices only. The stopped ones
+  // fall behind _paramsVersion and catch up in applyParams() at note-on.
+  template <typename F> void updateVoices(F &&update) {
+    _paramsVersion++;
+    for (size_t k = 0; k < _numActive; k++) {
+      const size_t i = _active[k];
+      update(_voices[i]);
+      _voiceParamsVersion[i] = _paramsVersion;
+    }
+  }
+
+  // Marks a parameter whose change costs the voices a retune or new filter
+  // coefficients. The sounding voices take all such changes at once at the
+  // next process(), so that a preset load or a block of automation
+  // rebuilds nothing twice.
+  void deferVoices(uint32_t flag) {
+    _deferred |= flag;
+    _paramsVersion++;
+  }
+
+  void applyDeferred() {
+    if (_deferred == 0)
+      return;
+    for (size_t k = 0; k < _numActive; k++) {
+      const size_t i = _active[k];
+      InharmonicVoice<T> &voice = _voices[i];
+      if (_deferred & kDeferredOscMix)
+        voice.setOscMix(_oscMix);
+      // the retune takes the bend along
+      if (_deferred & kDeferredBend)
+        voice.setFreqBend(_freqBend, (_deferred & kDeferredInharmonic) == 0);
+      if (_deferred & kDeferredInharmonic)
+        voice.setInharmonic(_inharmonic, _inharmonicSubscale);
+      if (_deferred & kDeferredFilter)
+        voice.setFilter(_filtCutoff, _filtReso);
+      _voiceParamsVersion[i] = _paramsVersion;
+    }
+    _deferred = 0;
+  }
+
+  void applyParams(size_t i) {
+    InharmonicVoice<T> &voice = _voices[i];
+    voice.setOscMix(_oscMix);
+    voice.setOscMode(_oscMode);
+    voice.setInharmonic(_inharmonic, _inharmonicSubscale);
+    voice.setInharmKeyFollow(_inharmKeyFollow);
+    voice.setFreqBend(_freqBend);
+    voice.getEnvAmp().setA(_ampEnvA, _fs);
+    voice.getEnvAmp().setD(_ampEnvD, _fs);
+    voice.getEnvAmp().setS(_ampEnvS);
+    voice.getEnvAmp().setR(_ampEnvR, _fs);
+    voice.setAmpVeloSens(_ampVeloSens);
+    voice.setVibDelay(_vibDelay);
+    voice.setVibDepth(_vibDepth);
+    voice.setVibSpeed(_vibSpeed);
+    voice.setFilterType(_filtType);
+    voice.setFilter(_filtCutoff, _filtReso);
+    voice.setFilterEnvAmount(_filtEnvAmount);
+    voice.getEnvFilt().setA(_filtEnvA, _fs);
+    voice.getEnvFilt().setD(_filtEnvD, _fs);
+    voice.getEnvFilt().setS(_filtEnvS);
+    voice.getEnvFilt().setR(_filtEnvR, _fs);
+    voice.getEnvAmp().setCurve(_envCurve);
+    voice.getEnvFilt().setCurve(_envCurve);
+    voice.setFiltKeyFollow(_filtKeyFollow);
+    _voiceParamsVersion[i] = _paramsVersion;
+  }
+
+  // Adds voice i to the active list, which stays in voice order so that the
+  // voices sum in the same order whichever of them are sounding.
+  void activate(size_t i) {
+    size_t k = _numActive;
+    for (; k > 0 && _active[k - 1] >= i; k--) {
+      if (_active[k - 1] == i)
+        return;
+    }
+    std::copy_backward(_active + k, _active + _numActive,
+                       _active + _numActive + 1);
+    _active[k] = i;
+    _numActive++;
+  }
+
+  void retireStoppedVoices() {
+    size_t numActive = 0;
+    for (size_t k = 0; k < _numActive; k++) {
+      const size_t i = _active[k];
+      if (!_voices[i].isStopped()) {
+        _active[numActive++] = i;
+        continue;
+      }
+      unlinkPitch(i);
+      if (i < _polyphony)
+        _free[_numFree++] = i;
+    }
+    _numActive = numActive;
+  }
+
+  // Fills the free list with the stopped voices under the polyphony, to be
+  // taken from voice 0 up.
+  void resetFreeVoices() {
+    _numFree = 0;
+    for (size_t i = _polyphony; i-- > 0;) {
+      if (_voices[i].isStopped())
+        _free[_numFree++] = i;
+    }
+  }
+
+  size_t findVictim() const {
+    size_t victim = kNoVoice;
+    if (_voiceSteal == VoiceSteal::kQuietest) {
+      double quietest = HUGE_VAL;
+      for (size_t k = 0; k < _numActive; k++) {
+        const size_t i = _active[k];
+        const double level = _voices[i].getLevel();
+        if (i < _polyphony && level < quietest) {
+          quietest = level;
+          victim = i;
+        }
+      }
+    } else {
+      // released notes first, then by age
+      bool isReleased = false;
+      for (size_t k = 0; k < _numActive; k++) {
+        const size_t i = _active[k];
+        if (i >= _polyphony)
+          continue;
+        const bool released = _voices[i].isReleased();
+        if (victim == kNoVoice || released > isReleased ||
+            (released == isReleased && _voiceAge[i] < _voiceAge[victim])) {
+          victim = i;
+          isReleased = released;
+        }
+      }
+    }
+    return victim;
+  }
+
+  void stealVoice(size_t i, short pitch, double velocity) {
+    unlinkPitch(i);
+    _voices[i].steal(pitch, velocity, _isRandomPhase);
+    _voiceAge[i] = _noteCount++;
+    linkPitch(i, pitch);
+  }
+
+  void linkPitch(size_t i, short pitch) {
+    _voicePitch[i] = pitch;
+    _nextOfPitch[i] = _pitchHead[pitch];
+    _pitchHead[pitch] = i;
+  }
+
+  void unlinkPitch(size_t i) {
+    size_t *link = &_pitchHead[_voicePitch[i]];
+    while (*link != i) {
+      if (*link == kNoVoice)
+        return;
+      link = &_nextOfPitch[*link];
+    }
+    *link = _nextOfPitch[i];
+  }
+
+  // Adds n <= kMaxBlockSize samples of the m active voices from the k-th on
+  // to out[0] to out[m - 1], as one voice bank.
+  void processBank(size_t k, size_t m, T *const *out, size_t n) {
+    InharmonicVoice<T> *voices[kVoiceBankLanes];
+    for (size_t i = 0; i < m; i++)
+      voices[i] = &_voices[_active[k + i]];
+    InharmonicVoice<T>::processBank(voices, out, m, n);
+  }
+
+  // Renders the active voices into a buffer each, in banks as tasks of the
+  // pool, then sums the buffers in voice order, which adds exactly as
+  // process() does without the pool. The banks shrink until there are
+  // enough of them for all threads.
+  void processParallel(T *outL, T *outR, size_t n) {
+    const T outVolume = static_cast<T>(_outVolume);
+    const size_t numThreads = _renderPool->getNumThreads();
+    _parallelBankSize = std::min(kVoiceBankLanes,
+                                 (_numActive + numThreads - 1) / numThreads);
+    const size_t numBanks =
+        (_numActive + _parallelBankSize - 1) / _parallelBankSize;
+    for (size_t offset = 0; offset < n; offset += _voiceBufferSize) {
+      _parallelBlockSize = std::min(_voiceBufferSize, n - offset);
+      _renderPool->run(numBanks, &renderBank, this);
+      for (size_t t = 0; t < _parallelBlockSize; t++) {
+        T out = 0;
+        for (size_t k = 0; k < _numActive; k++)
+          out += _voiceBuffers[k * _voiceBufferSize + t];
+        outL[offset + t] = outR[offset + t] = out * outVolume;
+      }
+    }
+  }
+
+  static void renderBank(void *context, size_t index) {
+    InharmonicSynth &synth = *static_cast<InharmonicSynth *>(context);
+    const size_t k = index * synth._parallelBankSize;
+    const size_t m = std::min(synth._parallelBankSize, synth._numActive - k);
+    const size_t n = synth._parallelBlockSize;
+    T *buffers[kVoiceBankLanes];
+    for (size_t i = 0; i < m; i++) {
+      buffers[i] = synth._voiceBuffers.data() + (k + i) * synth._voiceBufferSize;
+      std::fill(buffers[i], buffers[i] + n, static_cast<T>(0));
+    }
+    for (size_t offset = 0; offset < n; offset += kMaxBlockSize) {
+      T *out[kVoiceBankLanes];
+      for (size_t i = 0; i < m; i++)
+        out[i] = buffers[i] + offset;
+      synth.processBank(k, m, out, std::min(kMaxBlockSize, n - offset));
+    }
+  }
+
   double _fs = 48000.0;
 
   // control state
@@ -634,19 +1964,75 @@ private:
   bool _sustainPedal = false;
   bool _sostenutoPedal = false;
   double _softPedal = 0;
+  double _freqBend = 1.0;
 
   double _outVolume = 0.25;
   double _bendRange = 2.0;
   bool _isRandomPhase = false;
-  double _ampEnvA = 0.0;
-  double _ampEnvD = 0.0;
-  double _ampEnvR = 0.0;
-  double _filtEnvA = 0.0;
-  double _filtEnvD = 0.0;
-  double _filtEnvR = 0.0;
-
-  static constexpr size_t kMaxVoices = 16;
-  InharmonicVoice _voices[kMaxVoices];
+
+  // voice parameters, as the voices start out
+  double _oscMix = 0.3;
+  OscMode _oscMode = OscMode::kTable;
+  double _inharmonic = 0.1;
+  double _inharmonicSubscale = 0.25;
+  double _inharmKeyFollow = 0;
+  double _ampEnvA = 0;
+  double _ampEnvD = 0;
+  double _ampEnvS = 0.8;
+  double _ampEnvR = 0;
+  double _ampVeloSens = 1.0;
+  double _vibDelay = 0;
+  double _vibDepth = 0;
+  double _vibSpeed = 2.0;
+  short _filtType = 0;
+  double _filtCutoff = 4000;
+  double _filtReso = 0.5;
+  double _filtEnvAmount = 0;
+  double _filtEnvA = 0;
+  double _filtEnvD = 0;
+  double _filtEnvS = 0.8;
+  double _filtEnvR = 0;
+  double _filtKeyFollow = 0;
+  double _envCurve = 0;
+
+  static constexpr short kNumPitches = 128;
+  static constexpr size_t kNoVoice = kMaxVoices;
+  // below this many samples, waking the workers costs more than they save
+  static constexpr size_t kMinParallelBlockSize = 128;
+  PartialRatioCache _ratioCache;
+  SvfCutoffTable _cutoffTable;
+  std::vector<InharmonicVoice<T>> _voices;
+  // the voices that are not stopped, in voice order
+  size_t _active[kMaxVoices] = {};
+  size_t _numActive = 0;
+  // the stopped voices under the polyphony, taken from the end
+  size_t _free[kMaxVoices] = {};
+  size_t _numFree = 0;
+  size_t _polyphony = 16;
+  VoiceSteal _voiceSteal = VoiceSteal::kOldest;
+  // the sounding voices of each pitch as linked lists, for note-off
+  size_t _pitchHead[kNumPitches];
+  size_t _nextOfPitch[kMaxVoices] = {};
+  short _voicePitch[kMaxVoices] = {};
+  // note-on count at each voice's note, for stealing the oldest
+  uint64_t _voiceAge[kMaxVoices] = {};
+  uint64_t _noteCount = 0;
+  // bumped by every voice parameter change, which voice i has seen up to
+  // _voiceParamsVersion[i]
+  uint32_t _paramsVersion = 0;
+  uint32_t _voiceParamsVersion[kMaxVoices] = {};
+  // the deferred changes the sounding voices are yet to take
+  static constexpr uint32_t kDeferredBend = 1 << 0;
+  static constexpr uint32_t kDeferredInharmonic = 1 << 1;
+  static constexpr uint32_t kDeferredFilter = 1 << 2;
+  static constexpr uint32_t kDeferredOscMix = 1 << 3;
+  uint32_t _deferred = 0;
+
+  RenderPool *_renderPool = nullptr;
+  std::vector<T> _voiceBuffers;
+  size_t _voiceBufferSize = 0;
+  size_t _parallelBlockSize = 0;
+  size_t _parallelBankSize = 1;
 };
 
 } // namespace Inharmonic
@@ -0,0 +1,644 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define INHARMONIC_PARTIALBANK_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define INHARMONIC_PARTIALBANK_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INHARMONIC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define INHARMONIC_TARGET_AVX2
+#endif
+
+namespace Inharmonic {
+
+// A partial bank renders a block of sums of table-looked-up sinusoids:
+//
+//   out[t] = sum_i amp[i] * lerp(table, phase[i] * tableScale)
+//   phase[i] = fract(phase[i] + steps[i] * oscMod[t])
+//
+// where the table holds a (value, slope) pair of floats per step, see
+// CosTable, and lerp(table, x) = value[k] + (x - k) * slope[k] at k = (int)x.
+// The arrays are SoA lanes aligned to kPartialBankAlign bytes, and `n` must be
+// a multiple of kPartialBankLanes (pad unused lanes with amp = steps = 0).
+// The table needs a guard step past tableScale, because float phases just
+// below 1 can round up to the end of the table. Every kernel updates the
+// phases bit-identically to the scalar one; only the order of the final
+// summation differs, so outputs agree within n * EPSILON * sum(|amp|) (below
+// 1e-12 in double and 2e-5 in float for 128 partials of 1/n).
+//
+// A phasor bank renders the same sum without any table, advancing each
+// partial as a complex rotation by its rotor (rotRe[i], rotIm[i]):
+//
+//   out[t] = sum_i amp[i] * re[i]
+//   (re[i], im[i]) *= (rotRe[i], rotIm[i])
+//
+// The rotors are constant over the block. The caller keeps |(re, im)| = 1 by
+// renormalizing every few hundred samples.
+//
+// Both come in double and float flavors. Double lanes run 2 (SSE2, NEON) or 4
+// (AVX2) partials per instruction, and float lanes 4 or 8.
+static constexpr size_t kPartialBankLanes = 8;
+static constexpr size_t kPartialBankAlign = 32;
+
+template <typename T>
+using PartialBankKernel = void (*)(const T *amp, const T *steps, T *phase,
+                                   size_t n, const T *oscMod, T *out,
+                                   size_t numSamples, const float *table,
+                                   T tableScale);
+template <typename T>
+using PhasorBankKernel = void (*)(const T *amp, const T *rotRe,
+                                  const T *rotIm, T *re, T *im, size_t n,
+                                  T *out, size_t numSamples);
+
+template <typename T> struct PartialBankKernels {
+  PartialBankKernel<T> table;
+  PhasorBankKernel<T> phasor;
+};
+
+namespace {
+
+template <typename T>
+static inline void partialBankScalar(const T *amp, const T *steps, T *phase,
+                                     size_t n, const T *oscMod, T *out,
+                                     size_t numSamples, const float *table,
+                                     T tableScale) {
+  for (size_t t = 0; t < numSamples; t++) {
+    const T mod = oscMod[t];
+    T sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      const T pos = phase[i] * tableScale;
+      const int k = static_cast<int>(pos);
+      const T frac = pos - static_cast<T>(k);
+      const float *step = table + 2 * k;
+      sum += amp[i] * (step[0] + frac * step[1]);
+      phase[i] += steps[i] * mod;
+      phase[i] -= static_cast<int>(phase[i]);
+    }
+    out[t] = sum;
+  }
+}
+
+template <typename T>
+static inline void phasorBankScalar(const T *amp, const T *rotRe,
+                                    const T *rotIm, T *re, T *im, size_t n,
+                                    T *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    T sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += amp[i] * re[i];
+      const T r = re[i] * rotRe[i] - im[i] * rotIm[i];
+      im[i] = re[i] * rotIm[i] + im[i] * rotRe[i];
+      re[i] = r;
+    }
+    out[t] = sum;
+  }
+}
+
+#if defined(INHARMONIC_PARTIALBANK_X86)
+static inline float horizontalSum(__m128 x) {
+  x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+  x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+  return _mm_cvtss_f32(x);
+}
+
+static inline void partialBankSSE2(const double *amp, const double *steps,
+                                   double *phase, size_t n,
+                                   const double *oscMod, double *out,
+                                   size_t numSamples, const float *table,
+                                   double tableScale) {
+  const __m128d scale = _mm_set1_pd(tableScale);
+  alignas(16) int32_t idx[4];
+  for (size_t t = 0; t < numSamples; t++) {
+    const __m128d mod = _mm_set1_pd(oscMod[t]);
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (size_t i = 0; i < n; i += 4) {
+      __m128d p0 = _mm_load_pd(phase + i);
+      __m128d p1 = _mm_load_pd(phase + i + 2);
+
+      // SSE2 has no gather, so the table reads stay scalar
+      const __m128d pos0 = _mm_mul_pd(p0, scale);
+      const __m128d pos1 = _mm_mul_pd(p1, scale);
+      const __m128i i0 = _mm_cvttpd_epi32(pos0);
+      const __m128i i1 = _mm_cvttpd_epi32(pos1);
+      const __m128d f0 = _mm_sub_pd(pos0, _mm_cvtepi32_pd(i0));
+      const __m128d f1 = _mm_sub_pd(pos1, _mm_cvtepi32_pd(i1));
+      _mm_store_si128(reinterpret_cast<__m128i *>(idx),
+                      _mm_unpacklo_epi64(i0, i1));
+      const float *s0 = table + 2 * idx[0];
+      const float *s1 = table + 2 * idx[1];
+      const float *s2 = table + 2 * idx[2];
+      const float *s3 = table + 2 * idx[3];
+      const __m128d c0 = _mm_add_pd(
+          _mm_set_pd(s1[0], s0[0]), _mm_mul_pd(f0, _mm_set_pd(s1[1], s0[1])));
+      const __m128d c1 = _mm_add_pd(
+          _mm_set_pd(s3[0], s2[0]), _mm_mul_pd(f1, _mm_set_pd(s3[1], s2[1])));
+      acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_load_pd(amp + i), c0));
+      acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_load_pd(amp + i + 2), c1));
+
+      p0 = _mm_add_pd(p0, _mm_mul_pd(_mm_load_pd(steps + i), mod));
+      p1 = _mm_add_pd(p1, _mm_mul_pd(_mm_load_pd(steps + i + 2), mod));
+      p0 = _mm_sub_pd(p0, _mm_cvtepi32_pd(_mm_cvttpd_epi32(p0)));
+      p1 = _mm_sub_pd(p1, _mm_cvtepi32_pd(_mm_cvttpd_epi32(p1)));
+      _mm_store_pd(phase + i, p0);
+      _mm_store_pd(phase + i + 2, p1);
+    }
+    const __m128d acc = _mm_add_pd(acc0, acc1);
+    out[t] = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+  }
+}
+
+// Gathers the (value, slope) pairs of four steps as floats, in the order
+// v0 v1 v2 v3 s0 s1 s2 s3.
+INHARMONIC_TARGET_AVX2
+static inline __m256 gatherStepsAVX2(const float *table, __m128i idx) {
+  const __m256i all = _mm256_set1_epi64x(-1);
+  const __m256i pairs = _mm256_mask_i32gather_epi64(
+      _mm256_setzero_si256(), reinterpret_cast<const long long *>(table), idx,
+      all, 8);
+  return _mm256_permutevar8x32_ps(_mm256_castsi256_ps(pairs),
+                                  _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+}
+
+INHARMONIC_TARGET_AVX2
+static inline void partialBankAVX2(const double *amp, const double *steps,
+                                   double *phase, size_t n,
+                                   const double *oscMod, double *out,
+                                   size_t numSamples, const float *table,
+                                   double tableScale) {
+  const __m256d scale = _mm256_set1_pd(tableScale);
+  for (size_t t = 0; t < numSamples; t++) {
+    const __m256d mod = _mm256_set1_pd(oscMod[t]);
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (size_t i = 0; i < n; i += 8) {
+      __m256d p0 = _mm256_load_pd(phase + i);
+      __m256d p1 = _mm256_load_pd(phase + i + 4);
+
+      const __m256d pos0 = _mm256_mul_pd(p0, scale);
+      const __m256d pos1 = _mm256_mul_pd(p1, scale);
+      const __m128i i0 = _mm256_cvttpd_epi32(pos0);
+      const __m128i i1 = _mm256_cvttpd_epi32(pos1);
+      const __m256d f0 = _mm256_sub_pd(pos0, _mm256_cvtepi32_pd(i0));
+      const __m256d f1 = _mm256_sub_pd(pos1, _mm256_cvtepi32_pd(i1));
+      const __m256 s0 = gatherStepsAVX2(table, i0);
+      const __m256 s1 = gatherStepsAVX2(table, i1);
+      const __m256d c0 = _mm256_add_pd(
+          _mm256_cvtps_pd(_mm256_castps256_ps128(s0)),
+          _mm256_mul_pd(f0, _mm256_cvtps_pd(_mm256_extractf128_ps(s0, 1))));
+      const __m256d c1 = _mm256_add_pd(
+          _mm256_cvtps_pd(_mm256_castps256_ps128(s1)),
+          _mm256_mul_pd(f1, _mm256_cvtps_pd(_mm256_extractf128_ps(s1, 1))));
+      acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_load_pd(amp + i), c0));
+      acc1 =
+          _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_load_pd(amp + i + 4), c1));
+
+      p0 = _mm256_add_pd(p0, _mm256_mul_pd(_mm256_load_pd(steps + i), mod));
+      p1 = _mm256_add_pd(p1,
+                         _mm256_mul_pd(_mm256_load_pd(steps + i + 4), mod));
+      p0 = _mm256_sub_pd(p0, _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(p0)));
+      p1 = _mm256_sub_pd(p1, _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(p1)));
+      _mm256_store_pd(phase + i, p0);
+      _mm256_store_pd(phase + i + 4, p1);
+    }
+    const __m256d acc = _mm256_add_pd(acc0, acc1);
+    const __m128d sum2 = _mm_add_pd(_mm256_castpd256_pd128(acc),
+                                    _mm256_extractf128_pd(acc, 1));
+    out[t] = _mm_cvtsd_f64(_mm_add_sd(sum2, _mm_unpackhi_pd(sum2, sum2)));
+  }
+}
+
+static inline void phasorBankSSE2(const double *amp, const double *rotRe,
+                                  const double *rotIm, double *re, double *im,
+                                  size_t n, double *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (size_t i = 0; i < n; i += 4) {
+      const __m128d re0 = _mm_load_pd(re + i);
+      const __m128d re1 = _mm_load_pd(re + i + 2);
+      const __m128d im0 = _mm_load_pd(im + i);
+      const __m128d im1 = _mm_load_pd(im + i + 2);
+      const __m128d rr0 = _mm_load_pd(rotRe + i);
+      const __m128d rr1 = _mm_load_pd(rotRe + i + 2);
+      const __m128d ri0 = _mm_load_pd(rotIm + i);
+      const __m128d ri1 = _mm_load_pd(rotIm + i + 2);
+      acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_load_pd(amp + i), re0));
+      acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_load_pd(amp + i + 2), re1));
+      _mm_store_pd(re + i,
+                   _mm_sub_pd(_mm_mul_pd(re0, rr0), _mm_mul_pd(im0, ri0)));
+      _mm_store_pd(re + i + 2,
+                   _mm_sub_pd(_mm_mul_pd(re1, rr1), _mm_mul_pd(im1, ri1)));
+      _mm_store_pd(im + i,
+                   _mm_add_pd(_mm_mul_pd(re0, ri0), _mm_mul_pd(im0, rr0)));
+      _mm_store_pd(im + i + 2,
+                   _mm_add_pd(_mm_mul_pd(re1, ri1), _mm_mul_pd(im1, rr1)));
+    }
+    const __m128d acc = _mm_add_pd(acc0, acc1);
+    out[t] = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+  }
+}
+
+INHARMONIC_TARGET_AVX2
+static inline void phasorBankAVX2(const double *amp, const double *rotRe,
+                                  const double *rotIm, double *re, double *im,
+                                  size_t n, double *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (size_t i = 0; i < n; i += 8) {
+      const __m256d re0 = _mm256_load_pd(re + i);
+      const __m256d re1 = _mm256_load_pd(re + i + 4);
+      const __m256d im0 = _mm256_load_pd(im + i);
+      const __m256d im1 = _mm256_load_pd(im + i + 4);
+      const __m256d rr0 = _mm256_load_pd(rotRe + i);
+      const __m256d rr1 = _mm256_load_pd(rotRe + i + 4);
+      const __m256d ri0 = _mm256_load_pd(rotIm + i);
+      const __m256d ri1 = _mm256_load_pd(rotIm + i + 4);
+      acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_load_pd(amp + i), re0));
+      acc1 =
+          _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_load_pd(amp + i + 4), re1));
+      _mm256_store_pd(re + i, _mm256_sub_pd(_mm256_mul_pd(re0, rr0),
+                                            _mm256_mul_pd(im0, ri0)));
+      _mm256_store_pd(re + i + 4, _mm256_sub_pd(_mm256_mul_pd(re1, rr1),
+                                                _mm256_mul_pd(im1, ri1)));
+      _mm256_store_pd(im + i, _mm256_add_pd(_mm256_mul_pd(re0, ri0),
+                                            _mm256_mul_pd(im0, rr0)));
+      _mm256_store_pd(im + i + 4, _mm256_add_pd(_mm256_mul_pd(re1, ri1),
+                                                _mm256_mul_pd(im1, rr1)));
+    }
+    const __m256d acc = _mm256_add_pd(acc0, acc1);
+    const __m128d sum2 = _mm_add_pd(_mm256_castpd256_pd128(acc),
+                                    _mm256_extractf128_pd(acc, 1));
+    out[t] = _mm_cvtsd_f64(_mm_add_sd(sum2, _mm_unpackhi_pd(sum2, sum2)));
+  }
+}
+
+static inline void partialBankSSE2(const float *amp, const float *steps,
+                                   float *phase, size_t n, const float *oscMod,
+                                   float *out, size_t numSamples,
+                                   const float *table, float tableScale) {
+  const __m128 scale = _mm_set1_ps(tableScale);
+  alignas(16) int32_t idx[8];
+  for (size_t t = 0; t < numSamples; t++) {
+    const __m128 mod = _mm_set1_ps(oscMod[t]);
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+      __m128 p0 = _mm_load_ps(phase + i);
+      __m128 p1 = _mm_load_ps(phase + i + 4);
+
+      // SSE2 has no gather, so the table reads stay scalar
+      const __m128 pos0 = _mm_mul_ps(p0, scale);
+      const __m128 pos1 = _mm_mul_ps(p1, scale);
+      const __m128i i0 = _mm_cvttps_epi32(pos0);
+      const __m128i i1 = _mm_cvttps_epi32(pos1);
+      const __m128 f0 = _mm_sub_ps(pos0, _mm_cvtepi32_ps(i0));
+      const __m128 f1 = _mm_sub_ps(pos1, _mm_cvtepi32_ps(i1));
+      _mm_store_si128(reinterpret_cast<__m128i *>(idx), i0);
+      _mm_store_si128(reinterpret_cast<__m128i *>(idx + 4), i1);
+      // each step's pair is one 8-byte load; unpack them into values and
+      // slopes
+      __m128 pairs[4];
+      for (size_t k = 0; k < 4; k++) {
+        pairs[k] = _mm_castpd_ps(_mm_loadh_pd(
+            _mm_load_sd(reinterpret_cast<const double *>(table +
+                                                         2 * idx[2 * k])),
+            reinterpret_cast<const double *>(table + 2 * idx[2 * k + 1])));
+      }
+      const __m128 c0 = _mm_add_ps(
+          _mm_shuffle_ps(pairs[0], pairs[1], _MM_SHUFFLE(2, 0, 2, 0)),
+          _mm_mul_ps(f0, _mm_shuffle_ps(pairs[0], pairs[1],
+                                        _MM_SHUFFLE(3, 1, 3, 1))));
+      const __m128 c1 = _mm_add_ps(
+          _mm_shuffle_ps(pairs[2], pairs[3], _MM_SHUFFLE(2, 0, 2, 0)),
+          _mm_mul_ps(f1, _mm_shuffle_ps(pairs[2], pairs[3],
+                                        _MM_SHUFFLE(3, 1, 3, 1))));
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(amp + i), c0));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(amp + i + 4), c1));
+
+      p0 = _mm_add_ps(p0, _mm_mul_ps(_mm_load_ps(steps + i), mod));
+      p1 = _mm_add_ps(p1, _mm_mul_ps(_mm_load_ps(steps + i + 4), mod));
+      p0 = _mm_sub_ps(p0, _mm_cvtepi32_ps(_mm_cvttps_epi32(p0)));
+      p1 = _mm_sub_ps(p1, _mm_cvtepi32_ps(_mm_cvttps_epi32(p1)));
+      _mm_store_ps(phase + i, p0);
+      _mm_store_ps(phase + i + 4, p1);
+    }
+    out[t] = horizontalSum(_mm_add_ps(acc0, acc1));
+  }
+}
+
+INHARMONIC_TARGET_AVX2
+static inline void partialBankAVX2(const float *amp, const float *steps,
+                                   float *phase, size_t n, const float *oscMod,
+                                   float *out, size_t numSamples,
+                                   const float *table, float tableScale) {
+  const __m256 scale = _mm256_set1_ps(tableScale);
+  const __m256i all = _mm256_set1_epi64x(-1);
+  const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+  const long long *pairs = reinterpret_cast<const long long *>(table);
+  for (size_t t = 0; t < numSamples; t++) {
+    const __m256 mod = _mm256_set1_ps(oscMod[t]);
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+      __m256 p = _mm256_load_ps(phase + i);
+
+      const __m256 pos = _mm256_mul_ps(p, scale);
+      const __m256i idx = _mm256_cvttps_epi32(pos);
+      const __m256 frac = _mm256_sub_ps(pos, _mm256_cvtepi32_ps(idx));
+      // gather the pairs of lanes 0 1 4 5 and 2 3 6 7, so that shuffling
+      // within the 128-bit halves puts the values and slopes in lane order
+      const __m256i perm = _mm256_permutevar8x32_epi32(idx, order);
+      const __m256 lo = _mm256_castsi256_ps(_mm256_mask_i32gather_epi64(
+          _mm256_setzero_si256(), pairs, _mm256_castsi256_si128(perm), all,
+          8));
+      const __m256 hi = _mm256_castsi256_ps(_mm256_mask_i32gather_epi64(
+          _mm256_setzero_si256(), pairs, _mm256_extracti128_si256(perm, 1),
+          all, 8));
+      const __m256 c = _mm256_add_ps(
+          _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+          _mm256_mul_ps(frac,
+                        _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_load_ps(amp + i), c));
+
+      p = _mm256_add_ps(p, _mm256_mul_ps(_mm256_load_ps(steps + i), mod));
+      p = _mm256_sub_ps(p, _mm256_cvtepi32_ps(_mm256_cvttps_epi32(p)));
+      _mm256_store_ps(phase + i, p);
+    }
+    out[t] = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(acc),
+                                      _mm256_extractf128_ps(acc, 1)));
+  }
+}
+
+static inline void phasorBankSSE2(const float *amp, const float *rotRe,
+                                  const float *rotIm, float *re, float *im,
+                                  size_t n, float *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+      const __m128 re0 = _mm_load_ps(re + i);
+      const __m128 re1 = _mm_load_ps(re + i + 4);
+      const __m128 im0 = _mm_load_ps(im + i);
+      const __m128 im1 = _mm_load_ps(im + i + 4);
+      const __m128 rr0 = _mm_load_ps(rotRe + i);
+      const __m128 rr1 = _mm_load_ps(rotRe + i + 4);
+      const __m128 ri0 = _mm_load_ps(rotIm + i);
+      const __m128 ri1 = _mm_load_ps(rotIm + i + 4);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(amp + i), re0));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(amp + i + 4), re1));
+      _mm_store_ps(re + i,
+                   _mm_sub_ps(_mm_mul_ps(re0, rr0), _mm_mul_ps(im0, ri0)));
+      _mm_store_ps(re + i + 4,
+                   _mm_sub_ps(_mm_mul_ps(re1, rr1), _mm_mul_ps(im1, ri1)));
+      _mm_store_ps(im + i,
+                   _mm_add_ps(_mm_mul_ps(re0, ri0), _mm_mul_ps(im0, rr0)));
+      _mm_store_ps(im + i + 4,
+                   _mm_add_ps(_mm_mul_ps(re1, ri1), _mm_mul_ps(im1, rr1)));
+    }
+    out[t] = horizontalSum(_mm_add_ps(acc0, acc1));
+  }
+}
+
+INHARMONIC_TARGET_AVX2
+static inline void phasorBankAVX2(const float *amp, const float *rotRe,
+                                  const float *rotIm, float *re, float *im,
+                                  size_t n, float *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+      const __m256 re0 = _mm256_load_ps(re + i);
+      const __m256 im0 = _mm256_load_ps(im + i);
+      const __m256 rr0 = _mm256_load_ps(rotRe + i);
+      const __m256 ri0 = _mm256_load_ps(rotIm + i);
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_load_ps(amp + i), re0));
+      _mm256_store_ps(re + i, _mm256_sub_ps(_mm256_mul_ps(re0, rr0),
+                                            _mm256_mul_ps(im0, ri0)));
+      _mm256_store_ps(im + i, _mm256_add_ps(_mm256_mul_ps(re0, ri0),
+                                            _mm256_mul_ps(im0, rr0)));
+    }
+    out[t] = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(acc),
+                                      _mm256_extractf128_ps(acc, 1)));
+  }
+}
+
+static bool cpuHasAVX2() {
+  uint32_t leaf1[4] = {};
+  uint32_t leaf7[4] = {};
+#if defined(_MSC_VER) && !defined(__clang__)
+  int regs[4];
+  __cpuid(regs, 0);
+  if (regs[0] < 7)
+    return false;
+  __cpuidex(regs, 1, 0);
+  for (int i = 0; i < 4; i++)
+    leaf1[i] = static_cast<uint32_t>(regs[i]);
+  __cpuidex(regs, 7, 0);
+  for (int i = 0; i < 4; i++)
+    leaf7[i] = static_cast<uint32_t>(regs[i]);
+#else
+  if (__get_cpuid_max(0, nullptr) < 7)
+    return false;
+  __cpuid_count(1, 0, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+  __cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+  const bool osxsave = (leaf1[2] & (1U << 27)) != 0;
+  const bool avx = (leaf1[2] & (1U << 28)) != 0;
+  const bool avx2 = (leaf7[1] & (1U << 5)) != 0;
+  if (!osxsave || !avx || !avx2)
+    return false;
+
+  // the OS must also save the YMM registers on context switches
+#if defined(_MSC_VER) && !defined(__clang__)
+  const uint64_t xcr0 = _xgetbv(0);
+#else
+  uint32_t xcr0Lo, xcr0Hi;
+  __asm__ volatile("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+  const uint64_t xcr0 = (static_cast<uint64_t>(xcr0Hi) << 32) | xcr0Lo;
+#endif
+  return (xcr0 & 0x6) == 0x6;
+}
+#endif
+
+#if defined(INHARMONIC_PARTIALBANK_NEON)
+static inline void partialBankNEON(const double *amp, const double *steps,
+                                   double *phase, size_t n,
+                                   const double *oscMod, double *out,
+                                   size_t numSamples, const float *table,
+                                   double tableScale) {
+  // reads the values (offset 0) or slopes (offset 1) of both lanes' steps
+  auto load = [&](int64x2_t idx, int64_t offset) {
+    const float64x2_t c =
+        vdupq_n_f64(table[2 * vgetq_lane_s64(idx, 0) + offset]);
+    return vsetq_lane_f64(table[2 * vgetq_lane_s64(idx, 1) + offset], c, 1);
+  };
+  for (size_t t = 0; t < numSamples; t++) {
+    const float64x2_t mod = vdupq_n_f64(oscMod[t]);
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    for (size_t i = 0; i < n; i += 4) {
+      float64x2_t p0 = vld1q_f64(phase + i);
+      float64x2_t p1 = vld1q_f64(phase + i + 2);
+
+      // NEON has no gather, so the table reads stay scalar
+      const float64x2_t pos0 = vmulq_n_f64(p0, tableScale);
+      const float64x2_t pos1 = vmulq_n_f64(p1, tableScale);
+      const int64x2_t i0 = vcvtq_s64_f64(pos0);
+      const int64x2_t i1 = vcvtq_s64_f64(pos1);
+      const float64x2_t f0 = vsubq_f64(pos0, vcvtq_f64_s64(i0));
+      const float64x2_t f1 = vsubq_f64(pos1, vcvtq_f64_s64(i1));
+      const float64x2_t c0 = vaddq_f64(load(i0, 0), vmulq_f64(f0, load(i0, 1)));
+      const float64x2_t c1 = vaddq_f64(load(i1, 0), vmulq_f64(f1, load(i1, 1)));
+      acc0 = vaddq_f64(acc0, vmulq_f64(vld1q_f64(amp + i), c0));
+      acc1 = vaddq_f64(acc1, vmulq_f64(vld1q_f64(amp + i + 2), c1));
+
+      p0 = vaddq_f64(p0, vmulq_f64(vld1q_f64(steps + i), mod));
+      p1 = vaddq_f64(p1, vmulq_f64(vld1q_f64(steps + i + 2), mod));
+      p0 = vsubq_f64(p0, vcvtq_f64_s64(vcvtq_s64_f64(p0)));
+      p1 = vsubq_f64(p1, vcvtq_f64_s64(vcvtq_s64_f64(p1)));
+      vst1q_f64(phase + i, p0);
+      vst1q_f64(phase + i + 2, p1);
+    }
+    out[t] = vaddvq_f64(vaddq_f64(acc0, acc1));
+  }
+}
+
+static inline void phasorBankNEON(const double *amp, const double *rotRe,
+                                  const double *rotIm, double *re, double *im,
+                                  size_t n, double *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    for (size_t i = 0; i < n; i += 4) {
+      const float64x2_t re0 = vld1q_f64(re + i);
+      const float64x2_t re1 = vld1q_f64(re + i + 2);
+      const float64x2_t im0 = vld1q_f64(im + i);
+      const float64x2_t im1 = vld1q_f64(im + i + 2);
+      const float64x2_t rr0 = vld1q_f64(rotRe + i);
+      const float64x2_t rr1 = vld1q_f64(rotRe + i + 2);
+      const float64x2_t ri0 = vld1q_f64(rotIm + i);
+      const float64x2_t ri1 = vld1q_f64(rotIm + i + 2);
+      acc0 = vaddq_f64(acc0, vmulq_f64(vld1q_f64(amp + i), re0));
+      acc1 = vaddq_f64(acc1, vmulq_f64(vld1q_f64(amp + i + 2), re1));
+      vst1q_f64(re + i, vsubq_f64(vmulq_f64(re0, rr0), vmulq_f64(im0, ri0)));
+      vst1q_f64(re + i + 2,
+                vsubq_f64(vmulq_f64(re1, rr1), vmulq_f64(im1, ri1)));
+      vst1q_f64(im + i, vaddq_f64(vmulq_f64(re0, ri0), vmulq_f64(im0, rr0)));
+      vst1q_f64(im + i + 2,
+                vaddq_f64(vmulq_f64(re1, ri1), vmulq_f64(im1, rr1)));
+    }
+    out[t] = vaddvq_f64(vaddq_f64(acc0, acc1));
+  }
+}
+
+static inline void partialBankNEON(const float *amp, const float *steps,
+                                   float *phase, size_t n, const float *oscMod,
+                                   float *out, size_t numSamples,
+                                   const float *table, float tableScale) {
+  // reads the (value, slope) pairs of the four lanes' steps and splits them
+  auto load = [&](int32x4_t idx) {
+    const float32x2_t p0 = vld1_f32(table + 2 * vgetq_lane_s32(idx, 0));
+    const float32x2_t p1 = vld1_f32(table + 2 * vgetq_lane_s32(idx, 1));
+    const float32x2_t p2 = vld1_f32(table + 2 * vgetq_lane_s32(idx, 2));
+    const float32x2_t p3 = vld1_f32(table + 2 * vgetq_lane_s32(idx, 3));
+    return vuzpq_f32(vcombine_f32(p0, p1), vcombine_f32(p2, p3));
+  };
+  for (size_t t = 0; t < numSamples; t++) {
+    const float32x4_t mod = vdupq_n_f32(oscMod[t]);
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < n; i += 8) {
+      float32x4_t p0 = vld1q_f32(phase + i);
+      float32x4_t p1 = vld1q_f32(phase + i + 4);
+
+      // NEON has no gather, so the table reads stay scalar
+      const float32x4_t pos0 = vmulq_n_f32(p0, tableScale);
+      const float32x4_t pos1 = vmulq_n_f32(p1, tableScale);
+      const int32x4_t i0 = vcvtq_s32_f32(pos0);
+      const int32x4_t i1 = vcvtq_s32_f32(pos1);
+      const float32x4_t f0 = vsubq_f32(pos0, vcvtq_f32_s32(i0));
+      const float32x4_t f1 = vsubq_f32(pos1, vcvtq_f32_s32(i1));
+      const float32x4x2_t s0 = load(i0);
+      const float32x4x2_t s1 = load(i1);
+      const float32x4_t c0 = vaddq_f32(s0.val[0], vmulq_f32(f0, s0.val[1]));
+      const float32x4_t c1 = vaddq_f32(s1.val[0], vmulq_f32(f1, s1.val[1]));
+      acc0 = vaddq_f32(acc0, vmulq_f32(vld1q_f32(amp + i), c0));
+      acc1 = vaddq_f32(acc1, vmulq_f32(vld1q_f32(amp + i + 4), c1));
+
+      p0 = vaddq_f32(p0, vmulq_f32(vld1q_f32(steps + i), mod));
+      p1 = vaddq_f32(p1, vmulq_f32(vld1q_f32(steps + i + 4), mod));
+      p0 = vsubq_f32(p0, vcvtq_f32_s32(vcvtq_s32_f32(p0)));
+      p1 = vsubq_f32(p1, vcvtq_f32_s32(vcvtq_s32_f32(p1)));
+      vst1q_f32(phase + i, p0);
+      vst1q_f32(phase + i + 4, p1);
+    }
+    out[t] = vaddvq_f32(vaddq_f32(acc0, acc1));
+  }
+}
+
+static inline void phasorBankNEON(const float *amp, const float *rotRe,
+                                  const float *rotIm, float *re, float *im,
+                                  size_t n, float *out, size_t numSamples) {
+  for (size_t t = 0; t < numSamples; t++) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < n; i += 8) {
+      const float32x4_t re0 = vld1q_f32(re + i);
+      const float32x4_t re1 = vld1q_f32(re + i + 4);
+      const float32x4_t im0 = vld1q_f32(im + i);
+      const float32x4_t im1 = vld1q_f32(im + i + 4);
+      const float32x4_t rr0 = vld1q_f32(rotRe + i);
+      const float32x4_t rr1 = vld1q_f32(rotRe + i + 4);
+      const float32x4_t ri0 = vld1q_f32(rotIm + i);
+      const float32x4_t ri1 = vld1q_f32(rotIm + i + 4);
+      acc0 = vaddq_f32(acc0, vmulq_f32(vld1q_f32(amp + i), re0));
+      acc1 = vaddq_f32(acc1, vmulq_f32(vld1q_f32(amp + i + 4), re1));
+      vst1q_f32(re + i, vsubq_f32(vmulq_f32(re0, rr0), vmulq_f32(im0, ri0)));
+      vst1q_f32(re + i + 4,
+                vsubq_f32(vmulq_f32(re1, rr1), vmulq_f32(im1, ri1)));
+      vst1q_f32(im + i, vaddq_f32(vmulq_f32(re0, ri0), vmulq_f32(im0, rr0)));
+      vst1q_f32(im + i + 4,
+                vaddq_f32(vmulq_f32(re1, ri1), vmulq_f32(im1, rr1)));
+    }
+    out[t] = vaddvq_f32(vaddq_f32(acc0, acc1));
+  }
+}
+#endif
+
+template <typename T>
+static PartialBankKernels<T> detectPartialBankKernels() {
+#if defined(INHARMONIC_PARTIALBANK_X86)
+  if (cpuHasAVX2())
+    return {partialBankAVX2, phasorBankAVX2};
+  return {partialBankSSE2, phasorBankSSE2};
+#elif defined(INHARMONIC_PARTIALBANK_NEON)
+  return {partialBankNEON, phasorBankNEON};
+#else
+  return {partialBankScalar<T>, phasorBankScalar<T>};
+#endif
+}
+
+// Returns the fastest kernels this CPU supports. The detection runs once.
+template <typename T>
+static inline const PartialBankKernels<T> &getPartialBankKernels() {
+  static const PartialBankKernels<T> kernels = detectPartialBankKernels<T>();
+  return kernels;
+}
+
+} // namespace
+
+} // namespace Inharmonic
@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+// Worker threads for real-time use are off unless the build turns them on;
+// offline rendering uses the pool regardless.
+#ifndef INHARMONIC_REALTIME_RENDER_THREADS
+#define INHARMONIC_REALTIME_RENDER_THREADS 0
+#endif
+
+namespace Inharmonic {
+
+// A counting semaphore on the native primitive of each platform. post() is a
+// single lock-free system call at most, so the audio thread may use it.
+class RenderSemaphore {
+public:
+  RenderSemaphore() {
+#if defined(_WIN32)
+    _handle = CreateSemaphore(nullptr, 0, LONG_MAX, nullptr);
+#elif defined(__APPLE__)
+    _handle = dispatch_semaphore_create(0);
+#else
+    sem_init(&_handle, 0, 0);
+#endif
+  }
+  ~RenderSemaphore() {
+#if defined(_WIN32)
+    CloseHandle(_handle);
+#elif defined(__APPLE__)
+    dispatch_release(_handle);
+#else
+    sem_destroy(&_handle);
+#endif
+  }
+  RenderSemaphore(const RenderSemaphore &) = delete;
+  RenderSemaphore &operator=(const RenderSemaphore &) = delete;
+
+  void post() {
+#if defined(_WIN32)
+    ReleaseSemaphore(_handle, 1, nullptr);
+#elif defined(__APPLE__)
+    dispatch_semaphore_signal(_handle);
+#else
+    sem_post(&_handle);
+#endif
+  }
+
+  void wait() {
+#if defined(_WIN32)
+    WaitForSingleObject(_handle, INFINITE);
+#elif defined(__APPLE__)
+    dispatch_semaphore_wait(_handle, DISPATCH_TIME_FOREVER);
+#else
+    while (sem_wait(&_handle) != 0) {
+    }
+#endif
+  }
+
+private:
+#if defined(_WIN32)
+  HANDLE _handle;
+#elif defined(__APPLE__)
+  dispatch_semaphore_t _handle;
+#else
+  sem_t _handle;
+#endif
+};
+
+// Runs batches of independent tasks on a fixed set of pre-spawned worker
+// threads and the calling thread. run() neither locks nor allocates: it hands
+// each participant a contiguous range of the task indices, wakes the workers
+// through their semaphores, and spins until all tasks are done. Participants
+// that run out take tasks from the others' ranges, so uneven tasks still
+// balance.
+//
+// Each range is a single atomic word tagged with the batch number, so a
+// worker that wakes late can never take a task of a later batch.
+class RenderPool {
+public:
+  using Task = void (*)(void *context, size_t index);
+  using WorkerHook = void (*)();
+
+  static constexpr size_t kMaxThreads = 16;
+
+  RenderPool() = default;
+  ~RenderPool() { stop(); }
+  RenderPool(const RenderPool &) = delete;
+  RenderPool &operator=(const RenderPool &) = delete;
+
+  // Has each worker call enter before it runs the tasks of a batch and leave
+  // after, so that the owner may mark the workers as part of its callback.
+  // Either may be null. The workers read them, so call it before start().
+  void setWorkerHooks(WorkerHook enter, WorkerHook leave) {
+    _enterWorker = enter;
+    _leaveWorker = leave;
+  }
+
+  // worker threads worth spawning on this machine, besides the caller's
+  static size_t getDefaultNumWorkers() {
+    const size_t cores = std::thread::hardware_concurrency();
+    return std::min(kMaxThreads, std::max<size_t>(cores, 1)) - 1;
+  }
+
+  // Replaces the workers with numWorkers new ones. Spawns threads, so call it
+  // outside of processing.
+  void start(size_t numWorkers) {
+    numWorkers = std::min(numWorkers, kMaxThreads - 1);
+    if (numWorkers == _numWorkers)
+      return;
+    stop();
+    _isRunning.store(true, std::memory_order_relaxed);
+    _numWorkers = numWorkers;
+    for (size_t i = 0; i < _numWorkers; i++)
+      _workers[i] = std::thread([this, i] { workerLoop(i + 1); });
+  }
+
+  void stop() {
+    if (_numWorkers == 0)
+      return;
+    _isRunning.store(false, std::memory_order_release);
+    for (size_t i = 0; i < _numWorkers; i++)
+      _wake[i].post();
+    for (size_t i = 0; i < _numWorkers; i++)
+      _workers[i].join();
+    _numWorkers = 0;
+  }
+
+  // the workers plus the calling thread
+  size_t getNumThreads() const { return _numWorkers + 1; }
+
+  // Calls task(context, i) for every i < count (below 65536), spread over the
+  // threads, and returns once all calls have returned.
+  void run(size_t count, Task task, void *context) {
+    if (_numWorkers == 0 || count <= 1) {
+      for (size_t i = 0; i < count; i++)
+        task(context, i);
+      return;
+    }
+
+    const uint64_t batch = (_batch.load(std::memory_order_relaxed) + 1) &
+                           kBatchMask;
+    _task = task;
+    _context = context;
+    _remaining.store(count, std::memory_order_relaxed);
+    const size_t numThreads = getNumThreads();
+    for (size_t p = 0; p < numThreads; p++) {
+      const uint64_t begin = count * p / numThreads;
+      const uint64_t end = count * (p + 1) / numThreads;
+      _ranges[p].state.store(pack(batch, begin, end),
+                             std::memory_order_relaxed);
+    }
+    for (size_t p = numThreads; p < kMaxThreads; p++)
+      _ranges[p].state.store(pack(batch, 0, 0), std::memory_order_relaxed);
+    _batch.store(batch, std::memory_order_release);
+    for (size_t i = 0; i < _numWorkers; i++)
+      _wake[i].post();
+
+    work(0, batch);
+    while (_remaining.load(std::memory_order_acquire) != 0)
+      pause();
+  }
+
+private:
+  static constexpr uint64_t kIndexBits = 16;
+  static constexpr uint64_t kIndexMask = (uint64_t(1) << kIndexBits) - 1;
+  static constexpr uint64_t kBatchMask = (uint64_t(1) << 32) - 1;
+
+  // batch in the top 32 bits, then the end and the next index of a range
+  static uint64_t pack(uint64_t batch, uint64_t next, uint64_t end) {
+    return (batch << (2 * kIndexBits)) | (end << kIndexBits) | next;
+  }
+
+  static void pause() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+    __asm__ volatile("yield");
+#endif
+  }
+
+  // Takes the next task of range p if it belongs to this batch.
+  bool take(size_t p, uint64_t batch, size_t &index) {
+    std::atomic<uint64_t> &state = _ranges[p].state;
+    uint64_t s = state.load(std::memory_order_acquire);
+    for (;;) {
+      const uint64_t next = s & kIndexMask;
+      const uint64_t end = (s >> kIndexBits) & kIndexMask;
+      if ((s >> (2 * kIndexBits)) != batch || next >= end)
+        return false;
+      if (state.compare_exchange_weak(s, s + 1, std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+        index = static_cast<size_t>(next);
+        return true;
+      }
+    }
+  }
+
+  // Drains range self, then steals from the others.
+  void work(size_t self, uint64_t batch) {
+    const size_t numThreads = getNumThreads();
+    for (size_t k = 0; k < numThreads; k++) {
+      const size_t p = (self + k) % numThreads;
+      size_t index;
+      while (take(p, batch, index)) {
+        // the batch cannot end before this task, so its job is still current
+        _task(_context, index);
+        _remaining.fetch_sub(1, std::memory_order_acq_rel);
+      }
+    }
+  }
+
+  void workerLoop(size_t self) {
+    for (;;) {
+      _wake[self - 1].wait();
+      if (!_isRunning.load(std::memory_order_acquire))
+        return;
+      // around the tasks only, not the wait above
+      if (_enterWorker)
+        _enterWorker();
+      work(self, _batch.load(std::memory_order_acquire));
+      if (_leaveWorker)
+        _leaveWorker();
+    }
+  }
+
+  struct alignas(64) Range {
+    std::atomic<uint64_t> state{0};
+  };
+
+  size_t _numWorkers = 0;
+  std::atomic<bool> _isRunning{false};
+  std::atomic<uint64_t> _batch{0};
+  alignas(64) std::atomic<size_t> _remaining{0};
+  Task _task = nullptr;
+  void *_context = nullptr;
+  WorkerHook _enterWorker = nullptr;
+  WorkerHook _leaveWorker = nullptr;
+  Range _ranges[kMaxThreads];
+  RenderSemaphore _wake[kMaxThreads - 1];
+  std::thread _workers[kMaxThreads - 1];
+};
+
+} // namespace Inharmonic
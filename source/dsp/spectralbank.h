@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace Inharmonic {
+
+// A spectral partial bank renders sums of sinusoids by inverse FFT, after
+// X. Rodet and P. Depalle: "Spectral Envelopes and Inverse FFT Synthesis"
+// (1992). For each frame, every partial adds the main lobe of a 4-term
+// Blackman-Harris window, shifted to its frequency and rotated by its phase,
+// to a spectrum. One inverse FFT then yields all partials under that window,
+// which is divided out again and replaced by a triangle spanning two hops, so
+// that consecutive frames overlap-add to constant gain.
+//
+// Per hop this costs one real FFT of kSpectralFrameSize plus eight bins per
+// partial, instead of a lookup per partial per sample. Frequencies are held
+// over each hop, and the truncated side lobes leave an error of -90 dB of a
+// partial's amplitude.
+static constexpr size_t kSpectralFrameSize = 512;
+static constexpr size_t kSpectralHopSize = kSpectralFrameSize / 4;
+
+template <typename T> struct SpectralTables {
+  static constexpr size_t kFrame = kSpectralFrameSize;
+  static constexpr size_t kHalf = kFrame / 2;
+  static constexpr size_t kHop = kSpectralHopSize;
+  static constexpr size_t kLobeBins = 8;
+  static constexpr size_t kLobeSteps = 256;
+
+  // lobe[r * kLobeBins + j] is the window spectrum at bin offset
+  // j - 3 - r / kLobeSteps, scaled for an unnormalized inverse transform
+  T lobe[(kLobeSteps + 1) * kLobeBins];
+  // triangle over Blackman-Harris for the 2 * kHop samples around the center
+  T window[2 * kHop];
+  // e^(2 pi i k / kFrame), to split the real transform into a half-size one
+  T splitRe[kHalf];
+  T splitIm[kHalf];
+  // e^(pi i j / h) for j < h at [h - 1 + j], for every butterfly span h of
+  // the half-size inverse transform
+  T twiddleRe[kHalf];
+  T twiddleIm[kHalf];
+  uint16_t bitReverse[kHalf];
+
+  SpectralTables() {
+    constexpr double pi = 3.141592653589793238;
+    constexpr double a[4] = {0.35875, 0.48829, 0.14128, 0.01168};
+    const double n = static_cast<double>(kFrame);
+
+    // spectrum of the centered window, sum_m a[m] cos(2 pi m t / n), from the
+    // real part of the centered Dirichlet kernel
+    auto dirichlet = [&](double d) {
+      if (std::fabs(d - std::round(d)) < 1e-12)
+        return std::round(d) == 0 ? n : 0.0;
+      return sin(pi * d) / tan(pi * d / n);
+    };
+    for (size_t r = 0; r <= kLobeSteps; r++) {
+      for (size_t j = 0; j < kLobeBins; j++) {
+        const double d = static_cast<double>(j) - 3.0 -
+                         static_cast<double>(r) / kLobeSteps;
+        double w = a[0] * dirichlet(d);
+        for (size_t m = 1; m < 4; m++)
+          w += 0.5 * a[m] * (dirichlet(d - m) + dirichlet(d + m));
+        // half of the amplitude goes to the positive frequency
+        lobe[r * kLobeBins + j] = static_cast<T>(0.5 * w / n);
+      }
+    }
+
+    for (size_t m = 0; m < 2 * kHop; m++) {
+      const double t = static_cast<double>(m) - kHop;
+      double w = 0;
+      for (size_t k = 0; k < 4; k++)
+        w += a[k] * cos(2.0 * pi * k * t / n);
+      window[m] = static_cast<T>((1.0 - std::fabs(t) / kHop) / w);
+    }
+
+    for (size_t k = 0; k < kHalf; k++) {
+      splitRe[k] = static_cast<T>(cos(2.0 * pi * k / n));
+      splitIm[k] = static_cast<T>(sin(2.0 * pi * k / n));
+    }
+    for (size_t h = 1; h < kHalf; h <<= 1) {
+      for (size_t j = 0; j < h; j++) {
+        twiddleRe[h - 1 + j] = static_cast<T>(cos(pi * j / h));
+        twiddleIm[h - 1 + j] = static_cast<T>(sin(pi * j / h));
+      }
+    }
+    size_t bits = 0;
+    while ((size_t(1) << bits) < kHalf)
+      bits++;
+    for (size_t k = 0; k < kHalf; k++) {
+      size_t r = 0;
+      for (size_t b = 0; b < bits; b++)
+        r |= ((k >> b) & 1) << (bits - 1 - b);
+      bitReverse[k] = static_cast<uint16_t>(r);
+    }
+  }
+};
+
+namespace {
+
+// The tables are built once, on first use.
+template <typename T>
+static inline const SpectralTables<T> &getSpectralTables() {
+  static const SpectralTables<T> tables;
+  return tables;
+}
+
+} // namespace
+
+template <typename T> class SpectralPartialBank {
+public:
+  SpectralPartialBank() {
+    _tables = &getSpectralTables<T>();
+    reset();
+  }
+
+  // Drops the pending output. The next two frames are centered on the
+  // current sample and one hop later, so the output starts without a fade-in.
+  void reset() {
+    std::fill(_ola, _ola + 2 * kHop, static_cast<T>(0));
+    _pos = kHop;
+    _primed = false;
+  }
+
+  bool needsFrame() const { return _pos == kHop; }
+
+  void beginFrame() {
+    std::fill(_re, _re + kSpectrumSize, static_cast<T>(0));
+    std::fill(_im, _im + kSpectrumSize, static_cast<T>(0));
+  }
+
+  // Adds amplitude * e^(2 pi i phase) = (ampRe, ampIm) at frequency `step`
+  // (cycles per sample) to the frame. Partials at or above Nyquist are
+  // dropped.
+  void addPartial(T ampRe, T ampIm, double step) {
+    const double bin = step * kFrame;
+    if (!(bin >= 0 && bin < kHalf))
+      return;
+    const size_t k = static_cast<size_t>(bin);
+    const double pos = (bin - k) * SpectralTables<T>::kLobeSteps;
+    const size_t row = static_cast<size_t>(pos);
+    const T frac = static_cast<T>(pos - row);
+    const T *lobe0 = _tables->lobe + row * kLobeBins;
+    const T *lobe1 = lobe0 + kLobeBins;
+    // lobe entry j lands on bin k - 3 + j
+    T *re = _re + kMargin + k - 3;
+    T *im = _im + kMargin + k - 3;
+    for (size_t j = 0; j < kLobeBins; j++) {
+      const T l = lobe0[j] + frac * (lobe1[j] - lobe0[j]);
+      re[j] += ampRe * l;
+      im[j] += ampIm * l;
+    }
+  }
+
+  // Transforms the frame and overlap-adds it, making the next hop readable.
+  void endFrame() {
+    const SpectralTables<T> &tab = *_tables;
+    T *re = _re + kMargin;
+    T *im = _im + kMargin;
+
+    // fold the lobes that spill past DC and Nyquist back as the images of
+    // the negative frequencies, leaving a Hermitian spectrum
+    for (size_t j = 1; j <= kMargin; j++) {
+      re[j] += re[-static_cast<ptrdiff_t>(j)];
+      im[j] -= im[-static_cast<ptrdiff_t>(j)];
+      re[kHalf - j] += re[kHalf + j];
+      im[kHalf - j] -= im[kHalf + j];
+    }
+    re[0] *= 2;
+    im[0] = 0;
+    re[kHalf] *= 2;
+    im[kHalf] = 0;
+
+    // z = x[2m] + i x[2m + 1] is the half-size inverse transform of
+    // X[k] + conj(X[h - k]) + i e^(2 pi i k / n) (X[k] - conj(X[h - k]))
+    for (size_t k = 0; k < kHalf; k++) {
+      const T sumRe = re[k] + re[kHalf - k];
+      const T sumIm = im[k] - im[kHalf - k];
+      const T difRe = re[k] - re[kHalf - k];
+      const T difIm = im[k] + im[kHalf - k];
+      const T c = tab.splitRe[k];
+      const T s = tab.splitIm[k];
+      const size_t r = tab.bitReverse[k];
+      _zRe[r] = sumRe - (c * difIm + s * difRe);
+      _zIm[r] = sumIm + (c * difRe - s * difIm);
+    }
+    for (size_t i = 0; i < kHalf; i += 2) {
+      const T re0 = _zRe[i], im0 = _zIm[i];
+      _zRe[i] += _zRe[i + 1];
+      _zIm[i] += _zIm[i + 1];
+      _zRe[i + 1] = re0 - _zRe[i + 1];
+      _zIm[i + 1] = im0 - _zIm[i + 1];
+    }
+    for (size_t half = 2; half < kHalf; half <<= 1) {
+      const T *wRe = tab.twiddleRe + half - 1;
+      const T *wIm = tab.twiddleIm + half - 1;
+      for (size_t i = 0; i < kHalf; i += 2 * half) {
+        T *aRe = _zRe + i;
+        T *aIm = _zIm + i;
+        T *bRe = aRe + half;
+        T *bIm = aIm + half;
+        for (size_t j = 0; j < half; j++) {
+          const T vRe = bRe[j] * wRe[j] - bIm[j] * wIm[j];
+          const T vIm = bRe[j] * wIm[j] + bIm[j] * wRe[j];
+          bRe[j] = aRe[j] - vRe;
+          bIm[j] = aIm[j] - vIm;
+          aRe[j] += vRe;
+          aIm[j] += vIm;
+        }
+      }
+    }
+
+    // the frame is zero-phase, so sample t around its center sits at
+    // (t + n) % n
+    std::copy(_ola + kHop, _ola + 2 * kHop, _ola);
+    std::fill(_ola + kHop, _ola + 2 * kHop, static_cast<T>(0));
+    for (size_t m = 0; m < kHop; m += 2) {
+      const size_t z = (kFrame - kHop + m) / 2;
+      _ola[m] += _zRe[z] * tab.window[m];
+      _ola[m + 1] += _zIm[z] * tab.window[m + 1];
+    }
+    for (size_t m = kHop; m < 2 * kHop; m += 2) {
+      const size_t z = (m - kHop) / 2;
+      _ola[m] += _zRe[z] * tab.window[m];
+      _ola[m + 1] += _zIm[z] * tab.window[m + 1];
+    }
+
+    // the first frame after a reset only supplies the tail of the second
+    if (_primed)
+      _pos = 0;
+    _primed = true;
+  }
+
+  // Copies up to n readable samples to out and returns how many it copied.
+  size_t read(T *out, size_t n) {
+    const size_t len = std::min(n, kHop - _pos);
+    std::copy(_ola + _pos, _ola + _pos + len, out);
+    _pos += len;
+    return len;
+  }
+
+private:
+  static constexpr size_t kFrame = SpectralTables<T>::kFrame;
+  static constexpr size_t kHalf = SpectralTables<T>::kHalf;
+  static constexpr size_t kHop = SpectralTables<T>::kHop;
+  static constexpr size_t kLobeBins = SpectralTables<T>::kLobeBins;
+  // lobes reach 3 bins below DC and 4 above the highest bin below Nyquist
+  static constexpr size_t kMargin = 4;
+  static constexpr size_t kSpectrumSize = kMargin + kHalf + 1 + kMargin;
+
+  const SpectralTables<T> *_tables = nullptr;
+  size_t _pos = kHop;
+  bool _primed = false;
+  T _re[kSpectrumSize];
+  T _im[kSpectrumSize];
+  T _zRe[kHalf];
+  T _zIm[kHalf];
+  T _ola[2 * kHop];
+};
+
+} // namespace Inharmonic
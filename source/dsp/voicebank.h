@@ -0,0 +1,624 @@
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "fastmath.h"
+#include "partialbank.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INHARMONIC_FLATTEN __attribute__((flatten))
+#else
+#define INHARMONIC_FLATTEN
+#endif
+
+namespace Inharmonic {
+
+// A voice bank runs the envelopes and filters of kVoiceBankLanes voices side
+// by side, one voice per lane, so that each instruction advances all of them:
+// the voices copy their state into a lane before a block and take it back
+// after. Every lane goes through the same operations as the scalar code, in
+// the same order, so the results are bit-identical, with masks standing in
+// for its branches. Double lanes run 2 (SSE2, NEON) or 4 (AVX2) voices per
+// instruction, and float lanes 4 or 8. Unused lanes must hold a valid state,
+// which the default one is, and are computed along for nothing.
+static constexpr size_t kVoiceBankLanes = 8;
+static constexpr size_t kVoiceBankAlign = 64;
+
+enum class EnvState {
+  kAttack,
+  kDecay,
+  kSustain,
+  kRelease,
+  kFade,
+  kStop,
+};
+
+// Envelope generators as segments: remain runs down from 1 by step a sample,
+// and the level is target + span * shape(remain) until the sample nearest
+// to remain = 0 (remain <= step / 2, so that a segment of 1 / step samples
+// lasts exactly that many whatever the rounding), which lands on target,
+// and the next segment begins with remain = 1. The shape is remain itself
+// for a linear segment, and (2^(curve remain) - 1) norm, with
+// norm = 1 / (2^curve - 1), for an exponential one: a one-pole decay
+// towards just past the target, which it meets when the linear one would.
+// remain is kept as of the start of the segment or block, sample t taking
+// remain - (t - start + 1) step, so that segments are closed-form in t. The
+// attack goes on to the decay (decayStep and decayCurve, down to sustain),
+// the decay to a flat sustain, and a release or fade to the stop at zero.
+// The stage is an EnvState in a double, so that it masks the other lanes.
+//
+// A lane freezes from sample limit on, and count is the sample at which it
+// stopped (0 if it came in stopped, n if it did not stop).
+struct EnvBankLanes {
+  alignas(kVoiceBankAlign) double stage[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double remain[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double start[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double step[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double target[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double span[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double curve[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double norm[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double decayStep[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double decayCurve[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double decayNorm[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double sustain[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double level[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double limit[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) double count[kVoiceBankLanes];
+
+  EnvBankLanes() {
+    for (size_t l = 0; l < kVoiceBankLanes; l++) {
+      stage[l] = static_cast<double>(EnvState::kStop);
+      remain[l] = 1;
+      start[l] = step[l] = target[l] = span[l] = 0;
+      curve[l] = norm[l] = decayStep[l] = decayCurve[l] = decayNorm[l] = 0;
+      sustain[l] = level[l] = limit[l] = count[l] = 0;
+    }
+  }
+
+  bool isCurved() const {
+    for (size_t l = 0; l < kVoiceBankLanes; l++)
+      if (curve[l] != 0.0 || decayCurve[l] != 0.0)
+        return true;
+    return false;
+  }
+};
+
+// A lane of StateVariableFilter, with the cascade stage in p3 and p4. Ramps
+// move k, oqk and invDenom by their steps each sample and refine invDenom
+// with a Newton iteration, or divide in the lanes marked steep.
+template <typename T> struct SvfBankLanes {
+  alignas(kVoiceBankAlign) T k[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T oqk[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T invDenom[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T kStep[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T oqkStep[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T invDenomStep[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T steep[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T p1[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T p2[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T p3[kVoiceBankLanes];
+  alignas(kVoiceBankAlign) T p4[kVoiceBankLanes];
+
+  SvfBankLanes() {
+    for (size_t l = 0; l < kVoiceBankLanes; l++) {
+      k[l] = oqk[l] = kStep[l] = oqkStep[l] = invDenomStep[l] = steep[l] = 0;
+      invDenom[l] = 1;
+      p1[l] = p2[l] = p3[l] = p4[l] = 0;
+    }
+  }
+};
+
+// Renders n samples of every lane into env, interleaved as
+// env[t * kVoiceBankLanes + lane].
+using EnvBankKernel = void (*)(EnvBankLanes &lanes, double *env, size_t n);
+// Filters n interleaved samples of every lane in place, type 0, 1 and 2 being
+// lowpass, highpass and bandpass, with the cascade if iter is set. isRamp
+// moves the coefficients, and isSteep lets the steep lanes divide.
+template <typename T>
+using SvfBankKernel = void (*)(SvfBankLanes<T> &lanes, T *x, size_t n,
+                               short type, bool iter, bool isRamp,
+                               bool isSteep);
+
+template <typename T> struct VoiceBankKernels {
+  EnvBankKernel env;
+  SvfBankKernel<T> svf;
+};
+
+namespace {
+
+// The operations of the kernels on one native vector of kWidth lanes. The
+// masks M are what comparisons return, and select(m, a, b) takes a where m
+// is set. The double ones also have roundExp2(x, r), which rounds x to the
+// nearest integer r the way FastMath::exp2() does and returns 2^r, for
+// |x| < 1022.
+template <typename T> struct ScalarLaneOps {
+  using V = T;
+  using M = bool;
+  static constexpr size_t kWidth = 1;
+  static V load(const T *p) { return *p; }
+  static void store(T *p, V x) { *p = x; }
+  static V set1(T x) { return x; }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static M le(V a, V b) { return a <= b; }
+  static M lt(V a, V b) { return a < b; }
+  static M eq(V a, V b) { return a == b; }
+  static M both(M a, M b) { return a && b; }
+  static M either(M a, M b) { return a || b; }
+  static V select(M m, V a, V b) { return m ? a : b; }
+  static V roundExp2(V x, V &r) {
+    const int32_t i = static_cast<int32_t>(x + 1023.5);
+    r = static_cast<T>(i) - 1023.0;
+    const uint64_t bits = static_cast<uint64_t>(static_cast<uint32_t>(i))
+                          << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+  }
+};
+
+#if defined(INHARMONIC_PARTIALBANK_X86)
+struct SSE2LaneOpsD {
+  using V = __m128d;
+  using M = __m128d;
+  static constexpr size_t kWidth = 2;
+  static V load(const double *p) { return _mm_load_pd(p); }
+  static void store(double *p, V x) { _mm_store_pd(p, x); }
+  static V set1(double x) { return _mm_set1_pd(x); }
+  static V add(V a, V b) { return _mm_add_pd(a, b); }
+  static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+  static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+  static V div(V a, V b) { return _mm_div_pd(a, b); }
+  static M le(V a, V b) { return _mm_cmple_pd(a, b); }
+  static M lt(V a, V b) { return _mm_cmplt_pd(a, b); }
+  static M eq(V a, V b) { return _mm_cmpeq_pd(a, b); }
+  static M both(M a, M b) { return _mm_and_pd(a, b); }
+  static M either(M a, M b) { return _mm_or_pd(a, b); }
+  static V select(M m, V a, V b) {
+    return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b));
+  }
+  static V roundExp2(V x, V &r) {
+    const __m128i i = _mm_cvttpd_epi32(_mm_add_pd(x, _mm_set1_pd(1023.5)));
+    r = _mm_sub_pd(_mm_cvtepi32_pd(i), _mm_set1_pd(1023.0));
+    const __m128i bits = _mm_unpacklo_epi32(i, _mm_setzero_si128());
+    return _mm_castsi128_pd(_mm_slli_epi64(bits, 52));
+  }
+};
+
+struct SSE2LaneOpsF {
+  using V = __m128;
+  using M = __m128;
+  static constexpr size_t kWidth = 4;
+  static V load(const float *p) { return _mm_load_ps(p); }
+  static void store(float *p, V x) { _mm_store_ps(p, x); }
+  static V set1(float x) { return _mm_set1_ps(x); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm_div_ps(a, b); }
+  static M le(V a, V b) { return _mm_cmple_ps(a, b); }
+  static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+  static M eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+  static M both(M a, M b) { return _mm_and_ps(a, b); }
+  static M either(M a, M b) { return _mm_or_ps(a, b); }
+  static V select(M m, V a, V b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+  }
+};
+
+struct AVX2LaneOpsD {
+  using V = __m256d;
+  using M = __m256d;
+  static constexpr size_t kWidth = 4;
+  INHARMONIC_TARGET_AVX2 static V load(const double *p) {
+    return _mm256_load_pd(p);
+  }
+  INHARMONIC_TARGET_AVX2 static void store(double *p, V x) {
+    _mm256_store_pd(p, x);
+  }
+  INHARMONIC_TARGET_AVX2 static V set1(double x) { return _mm256_set1_pd(x); }
+  INHARMONIC_TARGET_AVX2 static V add(V a, V b) { return _mm256_add_pd(a, b); }
+  INHARMONIC_TARGET_AVX2 static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+  INHARMONIC_TARGET_AVX2 static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+  INHARMONIC_TARGET_AVX2 static V div(V a, V b) { return _mm256_div_pd(a, b); }
+  INHARMONIC_TARGET_AVX2 static M le(V a, V b) {
+    return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+  }
+  INHARMONIC_TARGET_AVX2 static M lt(V a, V b) {
+    return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+  }
+  INHARMONIC_TARGET_AVX2 static M eq(V a, V b) {
+    return _mm256_cmp_pd(a, b, _CMP_EQ_OQ);
+  }
+  INHARMONIC_TARGET_AVX2 static M both(M a, M b) { return _mm256_and_pd(a, b); }
+  INHARMONIC_TARGET_AVX2 static M either(M a, M b) {
+    return _mm256_or_pd(a, b);
+  }
+  INHARMONIC_TARGET_AVX2 static V select(M m, V a, V b) {
+    return _mm256_blendv_pd(b, a, m);
+  }
+  INHARMONIC_TARGET_AVX2 static V roundExp2(V x, V &r) {
+    const __m128i i =
+        _mm256_cvttpd_epi32(_mm256_add_pd(x, _mm256_set1_pd(1023.5)));
+    r = _mm256_sub_pd(_mm256_cvtepi32_pd(i), _mm256_set1_pd(1023.0));
+    const __m256i bits = _mm256_slli_epi64(_mm256_cvtepi32_epi64(i), 52);
+    return _mm256_castsi256_pd(bits);
+  }
+};
+
+struct AVX2LaneOpsF {
+  using V = __m256;
+  using M = __m256;
+  static constexpr size_t kWidth = 8;
+  INHARMONIC_TARGET_AVX2 static V load(const float *p) {
+    return _mm256_load_ps(p);
+  }
+  INHARMONIC_TARGET_AVX2 static void store(float *p, V x) {
+    _mm256_store_ps(p, x);
+  }
+  INHARMONIC_TARGET_AVX2 static V set1(float x) { return _mm256_set1_ps(x); }
+  INHARMONIC_TARGET_AVX2 static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  INHARMONIC_TARGET_AVX2 static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  INHARMONIC_TARGET_AVX2 static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  INHARMONIC_TARGET_AVX2 static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  INHARMONIC_TARGET_AVX2 static M le(V a, V b) {
+    return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+  }
+  INHARMONIC_TARGET_AVX2 static M lt(V a, V b) {
+    return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+  }
+  INHARMONIC_TARGET_AVX2 static M eq(V a, V b) {
+    return _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+  }
+  INHARMONIC_TARGET_AVX2 static M both(M a, M b) { return _mm256_and_ps(a, b); }
+  INHARMONIC_TARGET_AVX2 static M either(M a, M b) {
+    return _mm256_or_ps(a, b);
+  }
+  INHARMONIC_TARGET_AVX2 static V select(M m, V a, V b) {
+    return _mm256_blendv_ps(b, a, m);
+  }
+};
+#elif defined(INHARMONIC_PARTIALBANK_NEON)
+struct NEONLaneOpsD {
+  using V = float64x2_t;
+  using M = uint64x2_t;
+  static constexpr size_t kWidth = 2;
+  static V load(const double *p) { return vld1q_f64(p); }
+  static void store(double *p, V x) { vst1q_f64(p, x); }
+  static V set1(double x) { return vdupq_n_f64(x); }
+  static V add(V a, V b) { return vaddq_f64(a, b); }
+  static V sub(V a, V b) { return vsubq_f64(a, b); }
+  static V mul(V a, V b) { return vmulq_f64(a, b); }
+  static V div(V a, V b) { return vdivq_f64(a, b); }
+  static M le(V a, V b) { return vcleq_f64(a, b); }
+  static M lt(V a, V b) { return vcltq_f64(a, b); }
+  static M eq(V a, V b) { return vceqq_f64(a, b); }
+  static M both(M a, M b) { return vandq_u64(a, b); }
+  static M either(M a, M b) { return vorrq_u64(a, b); }
+  static V select(M m, V a, V b) { return vbslq_f64(m, a, b); }
+  static V roundExp2(V x, V &r) {
+    const int64x2_t i = vcvtq_s64_f64(vaddq_f64(x, vdupq_n_f64(1023.5)));
+    r = vsubq_f64(vcvtq_f64_s64(i), vdupq_n_f64(1023.0));
+    return vreinterpretq_f64_s64(vshlq_n_s64(i, 52));
+  }
+};
+
+struct NEONLaneOpsF {
+  using V = float32x4_t;
+  using M = uint32x4_t;
+  static constexpr size_t kWidth = 4;
+  static V load(const float *p) { return vld1q_f32(p); }
+  static void store(float *p, V x) { vst1q_f32(p, x); }
+  static V set1(float x) { return vdupq_n_f32(x); }
+  static V add(V a, V b) { return vaddq_f32(a, b); }
+  static V sub(V a, V b) { return vsubq_f32(a, b); }
+  static V mul(V a, V b) { return vmulq_f32(a, b); }
+  static V div(V a, V b) { return vdivq_f32(a, b); }
+  static M le(V a, V b) { return vcleq_f32(a, b); }
+  static M lt(V a, V b) { return vcltq_f32(a, b); }
+  static M eq(V a, V b) { return vceqq_f32(a, b); }
+  static M both(M a, M b) { return vandq_u32(a, b); }
+  static M either(M a, M b) { return vorrq_u32(a, b); }
+  static V select(M m, V a, V b) { return vbslq_f32(m, a, b); }
+};
+#endif
+
+// The bodies take AVX2 vectors in the generic code, but only ever run
+// inlined into the AVX2 kernels, whose ABI matches.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// Replaces every lane of x by FastMath::exp2() of it, with the same
+// operations in the same order, for |x| < 1022
+template <typename O> static inline void laneExp2(typename O::V &x) {
+  using V = typename O::V;
+#if INHARMONIC_FAST_MATH
+  V r;
+  const V scale = O::roundExp2(x, r);
+  const V f = O::sub(x, r);
+  V q = O::set1(FastMath::Detail::kExp2Poly[0]);
+  for (size_t j = 1; j < FastMath::Detail::kExp2PolySize; j++)
+    q = O::add(O::mul(q, f), O::set1(FastMath::Detail::kExp2Poly[j]));
+  x = O::mul(O::add(O::set1(1.0), O::mul(f, q)), scale);
+#else
+  alignas(kVoiceBankAlign) double y[O::kWidth];
+  O::store(y, x);
+  for (size_t l = 0; l < O::kWidth; l++)
+    y[l] = std::exp2(y[l]);
+  x = O::load(y);
+#endif
+}
+
+// n samples of the segments in EnvBankLanes, mirroring
+// InharmonicEnvGen::process(): where remain runs out, the level lands on the
+// target and the stage moves on. Without kIsCurved every segment is linear.
+template <typename O, bool kIsCurved>
+static inline void envBankBody(EnvBankLanes &s, double *env, size_t n) {
+  using V = typename O::V;
+  using M = typename O::M;
+  const V zero = O::set1(0.0);
+  const V one = O::set1(1.0);
+  const V half = O::set1(0.5);
+  const V attack = O::set1(static_cast<double>(EnvState::kAttack));
+  const V decay = O::set1(static_cast<double>(EnvState::kDecay));
+  const V sustain = O::set1(static_cast<double>(EnvState::kSustain));
+  const V stop = O::set1(static_cast<double>(EnvState::kStop));
+  const V size = O::set1(static_cast<double>(n));
+  for (size_t l = 0; l < kVoiceBankLanes; l += O::kWidth) {
+    const M isStopped = O::eq(O::load(s.stage + l), stop);
+    O::store(s.count + l, O::select(isStopped, zero, size));
+    O::store(s.start + l, zero);
+  }
+  for (size_t t = 0; t < n; t++) {
+    const V time = O::set1(static_cast<double>(t));
+    const V nextTime = O::set1(static_cast<double>(t + 1));
+    for (size_t l = 0; l < kVoiceBankLanes; l += O::kWidth) {
+      const V stage = O::load(s.stage + l);
+      const V step = O::load(s.step + l);
+      const V target = O::load(s.target + l);
+      const V span = O::load(s.span + l);
+      const V first = O::load(s.start + l);
+      const M isLive = O::lt(time, O::load(s.limit + l));
+      const V remain = O::sub(O::load(s.remain + l),
+                              O::mul(O::add(O::sub(time, first), one), step));
+      const M isDone = O::le(remain, O::mul(half, step));
+      const M isEnd = O::both(isLive, isDone);
+      V shape = remain;
+      if (kIsCurved) {
+        const V curve = O::load(s.curve + l);
+        V power = O::mul(curve, remain);
+        laneExp2<O>(power);
+        const V expShape = O::mul(O::sub(power, one), O::load(s.norm + l));
+        shape = O::select(O::eq(curve, zero), remain, expShape);
+      }
+      const V level =
+          O::select(isDone, target, O::add(target, O::mul(span, shape)));
+
+      const M isAttack = O::eq(stage, attack);
+      const M isDecay = O::eq(stage, decay);
+      const V next = O::select(isAttack, decay, O::select(isDecay, sustain, stop));
+      const V sustainLevel = O::load(s.sustain + l);
+      const V nextStep = O::select(isAttack, O::load(s.decayStep + l), zero);
+      const V nextTarget =
+          O::select(O::either(isAttack, isDecay), sustainLevel, zero);
+      const V nextSpan =
+          O::select(isAttack, O::sub(one, sustainLevel), zero);
+      const M isStop = O::both(isEnd, O::eq(next, stop));
+      O::store(s.count + l, O::select(isStop, time, O::load(s.count + l)));
+      O::store(s.step + l, O::select(isEnd, nextStep, step));
+      O::store(s.target + l, O::select(isEnd, nextTarget, target));
+      O::store(s.span + l, O::select(isEnd, nextSpan, span));
+      if (kIsCurved) {
+        const V nextCurve =
+            O::select(isAttack, O::load(s.decayCurve + l), zero);
+        const V nextNorm = O::select(isAttack, O::load(s.decayNorm + l), zero);
+        O::store(s.curve + l,
+                 O::select(isEnd, nextCurve, O::load(s.curve + l)));
+        O::store(s.norm + l, O::select(isEnd, nextNorm, O::load(s.norm + l)));
+      }
+      O::store(s.stage + l, O::select(isEnd, next, stage));
+      O::store(s.remain + l, O::select(isEnd, one, O::load(s.remain + l)));
+      O::store(s.start + l, O::select(isEnd, nextTime, first));
+      const V out = O::select(isLive, level, O::load(s.level + l));
+      O::store(s.level + l, out);
+      O::store(env + t * kVoiceBankLanes + l, out);
+    }
+  }
+  // remain at the end of the block, or at limit
+  for (size_t l = 0; l < kVoiceBankLanes; l += O::kWidth) {
+    const V limit = O::load(s.limit + l);
+    const V end = O::select(O::lt(limit, size), limit, size);
+    const V length = O::sub(end, O::load(s.start + l));
+    O::store(s.remain + l, O::sub(O::load(s.remain + l),
+                                  O::mul(length, O::load(s.step + l))));
+  }
+}
+
+template <typename O>
+static inline void envBankDispatch(EnvBankLanes &s, double *env, size_t n) {
+  if (s.isCurved())
+    envBankBody<O, true>(s, env, n);
+  else
+    envBankBody<O, false>(s, env, n);
+}
+
+// StateVariableFilter::processRamp() or process() on every lane
+template <typename O, typename T, bool kIter, bool kIsRamp, bool kIsSteep>
+static inline void svfBankBody(SvfBankLanes<T> &s, T *x, size_t n,
+                               short type) {
+  using V = typename O::V;
+  using M = typename O::M;
+  const V one = O::set1(1);
+  const V two = O::set1(2);
+  const V zero = O::set1(0);
+  for (size_t t = 0; t < n; t++) {
+    T *io = x + t * kVoiceBankLanes;
+    for (size_t l = 0; l < kVoiceBankLanes; l += O::kWidth) {
+      V k = O::load(s.k + l);
+      V oqk = O::load(s.oqk + l);
+      V invDenom = O::load(s.invDenom + l);
+      if (kIsRamp) {
+        k = O::add(k, O::load(s.kStep + l));
+        oqk = O::add(oqk, O::load(s.oqkStep + l));
+        const V denom = O::add(one, O::mul(k, oqk));
+        invDenom = O::add(invDenom, O::load(s.invDenomStep + l));
+        invDenom = O::mul(invDenom, O::sub(two, O::mul(denom, invDenom)));
+        if (kIsSteep) {
+          const M isSteep = O::lt(zero, O::load(s.steep + l));
+          invDenom = O::select(isSteep, O::div(one, denom), invDenom);
+        }
+        O::store(s.k + l, k);
+        O::store(s.oqk + l, oqk);
+        O::store(s.invDenom + l, invDenom);
+      }
+      V p1 = O::load(s.p1 + l);
+      V p2 = O::load(s.p2 + l);
+      V u;
+
+      V hp = O::mul(O::sub(O::sub(O::load(io + l), O::mul(oqk, p1)), p2),
+                    invDenom);
+      u = O::mul(hp, k);
+      V bp = O::add(u, p1);
+      p1 = O::add(u, bp);
+      u = O::mul(bp, k);
+      V lp = O::add(u, p2);
+      p2 = O::add(u, lp);
+      O::store(s.p1 + l, p1);
+      O::store(s.p2 + l, p2);
+      V y = type == 0 ? lp : type == 1 ? hp : bp;
+
+      if (kIter) {
+        V p3 = O::load(s.p3 + l);
+        V p4 = O::load(s.p4 + l);
+        hp = O::mul(O::sub(O::sub(y, O::mul(oqk, p3)), p4), invDenom);
+        u = O::mul(hp, k);
+        bp = O::add(u, p3);
+        p3 = O::add(u, bp);
+        u = O::mul(bp, k);
+        lp = O::add(u, p4);
+        p4 = O::add(u, lp);
+        O::store(s.p3 + l, p3);
+        O::store(s.p4 + l, p4);
+        y = type == 0 ? lp : type == 1 ? hp : bp;
+      }
+      O::store(io + l, y);
+    }
+  }
+}
+
+template <typename O, typename T>
+static inline void svfBankDispatch(SvfBankLanes<T> &s, T *x, size_t n,
+                                   short type, bool iter, bool isRamp,
+                                   bool isSteep) {
+  if (!isRamp) {
+    if (iter)
+      svfBankBody<O, T, true, false, false>(s, x, n, type);
+    else
+      svfBankBody<O, T, false, false, false>(s, x, n, type);
+  } else if (!isSteep) {
+    if (iter)
+      svfBankBody<O, T, true, true, false>(s, x, n, type);
+    else
+      svfBankBody<O, T, false, true, false>(s, x, n, type);
+  } else {
+    if (iter)
+      svfBankBody<O, T, true, true, true>(s, x, n, type);
+    else
+      svfBankBody<O, T, false, true, true>(s, x, n, type);
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// The kernels for one set of lane operations. Flattening inlines the bodies
+// and operations into each, so that the AVX2 ones compile as AVX2 throughout.
+#if defined(INHARMONIC_PARTIALBANK_X86)
+INHARMONIC_FLATTEN static inline void
+envBankSSE2(EnvBankLanes &s, double *env, size_t n) {
+  envBankDispatch<SSE2LaneOpsD>(s, env, n);
+}
+
+INHARMONIC_FLATTEN INHARMONIC_TARGET_AVX2 static inline void
+envBankAVX2(EnvBankLanes &s, double *env, size_t n) {
+  envBankDispatch<AVX2LaneOpsD>(s, env, n);
+}
+
+template <typename T>
+INHARMONIC_FLATTEN static inline void
+svfBankSSE2(SvfBankLanes<T> &s, T *x, size_t n, short type, bool iter,
+            bool isRamp, bool isSteep) {
+  using O = typename std::conditional<std::is_same<T, float>::value,
+                                      SSE2LaneOpsF, SSE2LaneOpsD>::type;
+  svfBankDispatch<O>(s, x, n, type, iter, isRamp, isSteep);
+}
+
+template <typename T>
+INHARMONIC_FLATTEN INHARMONIC_TARGET_AVX2 static inline void
+svfBankAVX2(SvfBankLanes<T> &s, T *x, size_t n, short type, bool iter,
+            bool isRamp, bool isSteep) {
+  using O = typename std::conditional<std::is_same<T, float>::value,
+                                      AVX2LaneOpsF, AVX2LaneOpsD>::type;
+  svfBankDispatch<O>(s, x, n, type, iter, isRamp, isSteep);
+}
+#elif defined(INHARMONIC_PARTIALBANK_NEON)
+INHARMONIC_FLATTEN static inline void
+envBankNEON(EnvBankLanes &s, double *env, size_t n) {
+  envBankDispatch<NEONLaneOpsD>(s, env, n);
+}
+
+template <typename T>
+INHARMONIC_FLATTEN static inline void
+svfBankNEON(SvfBankLanes<T> &s, T *x, size_t n, short type, bool iter,
+            bool isRamp, bool isSteep) {
+  using O = typename std::conditional<std::is_same<T, float>::value,
+                                      NEONLaneOpsF, NEONLaneOpsD>::type;
+  svfBankDispatch<O>(s, x, n, type, iter, isRamp, isSteep);
+}
+#else
+static inline void envBankScalar(EnvBankLanes &s, double *env, size_t n) {
+  envBankDispatch<ScalarLaneOps<double>>(s, env, n);
+}
+
+template <typename T>
+static inline void svfBankScalar(SvfBankLanes<T> &s, T *x, size_t n,
+                                 short type, bool iter, bool isRamp,
+                                 bool isSteep) {
+  svfBankDispatch<ScalarLaneOps<T>>(s, x, n, type, iter, isRamp, isSteep);
+}
+#endif
+
+template <typename T>
+static VoiceBankKernels<T> detectVoiceBankKernels() {
+#if defined(INHARMONIC_PARTIALBANK_X86)
+  if (cpuHasAVX2())
+    return {envBankAVX2, svfBankAVX2<T>};
+  return {envBankSSE2, svfBankSSE2<T>};
+#elif defined(INHARMONIC_PARTIALBANK_NEON)
+  return {envBankNEON, svfBankNEON<T>};
+#else
+  return {envBankScalar, svfBankScalar<T>};
+#endif
+}
+
+// Returns the fastest kernels this CPU supports. The detection runs once.
+template <typename T>
+static inline const VoiceBankKernels<T> &getVoiceBankKernels() {
+  static const VoiceBankKernels<T> kernels = detectVoiceBankKernels<T>();
+  return kernels;
+}
+
+} // namespace
+
+} // namespace Inharmonic
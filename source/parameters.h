@@ -2,6 +2,10 @@
 #include "pluginterfaces/vst/vsttypes.h"
 #include "public.sdk/source/vst/vsteditcontroller.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
 namespace AudioPlugin {
 
 // MIDI params
@@ -37,6 +41,10 @@ static const Steinberg::Vst::ParamID kTagFiltEnvD = 119;
 static const Steinberg::Vst::ParamID kTagFiltEnvS = 120;
 static const Steinberg::Vst::ParamID kTagFiltEnvR = 121;
 static const Steinberg::Vst::ParamID kTagFiltKeyFollow = 122;
+static const Steinberg::Vst::ParamID kTagOscMode = 123;
+static const Steinberg::Vst::ParamID kTagPolyphony = 124;
+static const Steinberg::Vst::ParamID kTagVoiceSteal = 125;
+static const Steinberg::Vst::ParamID kTagEnvCurve = 126;
 
 // effect params
 static const Steinberg::Vst::ParamID kTagEqF = 200;
@@ -50,15 +58,25 @@ static const Steinberg::Vst::ParamID kTagSampleDivision = 207;
 static const Steinberg::Vst::ParamID kTagReverbTime = 208;
 static const Steinberg::Vst::ParamID kTagReverbMix = 209;
 
+// Maps a normalized value x to the plain value min + (max - min) x^warp, or
+// 2 to the power of that with isExp2.
+struct ParamRange {
+  double warp;
+  double min;
+  double max;
+  bool isExp2 = false;
+};
+
 struct ParamSet {
   Steinberg::Vst::ParamID tag;
   const Steinberg::Vst::TChar *title;
   Steinberg::int32 stepCount;
   Steinberg::Vst::ParamValue defaultValueNormalized;
   Steinberg::int32 flags;
+  ParamRange range = {1.0, 0.0, 1.0, false};
 };
 
-static const ParamSet kAllParameters[] = {
+static constexpr ParamSet kAllParameters[] = {
     // midi params
     {kTagVolume, STR16("Volume"), 0, 1.0,
      Steinberg::Vst::ParameterInfo::kCanAutomate |
@@ -68,10 +86,12 @@ static const ParamSet kAllParameters[] = {
          Steinberg::Vst::ParameterInfo::kIsProgramChange},
     {kTagPitchBend, STR16("PitchBend"), 0, 0.5,
      Steinberg::Vst::ParameterInfo::kCanAutomate |
-         Steinberg::Vst::ParameterInfo::kIsProgramChange},
+         Steinberg::Vst::ParameterInfo::kIsProgramChange,
+     {1.0, -1.0, 1.0}},
     {kTagModWheel, STR16("ModWheel"), 0, 0.0,
      Steinberg::Vst::ParameterInfo::kCanAutomate |
-         Steinberg::Vst::ParameterInfo::kIsProgramChange},
+         Steinberg::Vst::ParameterInfo::kIsProgramChange,
+     {1.0, -1.0, 1.0}},
     {kTagSustainPedal, STR16("SustainPedal"), 0, 0.0,
      Steinberg::Vst::ParameterInfo::kCanAutomate |
          Steinberg::Vst::ParameterInfo::kIsProgramChange},
@@ -83,71 +103,158 @@ static const ParamSet kAllParameters[] = {
          Steinberg::Vst::ParameterInfo::kIsProgramChange},
 
     // voice params
-    {kTagOutVol, STR16("OutVol"), 0, 0.5, Steinberg::Vst::ParameterInfo::kCanAutomate},
+    {kTagOutVol, STR16("OutVol"), 0, 0.5,
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {2.0, 0.0, 0.5}},
     {kTagOscMix, STR16("OscMix"), 0, 0.3, Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagIsRandomPhase, STR16("IsRandomPhase"), 1, 0.0,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagInharmonic, STR16("Inharmonic"), 0, 0.3,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {5.0, 0.0, 0.5}},
     {kTagInharmonicSubscale, STR16("Subscale"), 0, 0.25,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagInharmKeyFollow, STR16("InharmKeyFollow"), 0, 0.25,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagAmpEnvA, STR16("AmpEnvA"), 0, 0.15,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {5.0, 1.0, 5000.0}},
     {kTagAmpEnvD, STR16("AmpEnvD"), 0, 0.7,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 1.0, 5000.0}},
     {kTagAmpEnvS, STR16("AmpEnvS"), 0, 0.25,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagAmpEnvR, STR16("AmpEnvR"), 0, 0.25,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 1.0, 5000.0}},
     {kTagAmpVeloSens, STR16("AmpVeloSens"), 0, 0.7,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagVibDelay, STR16("VibDelay"), 0, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 0.0, 2000.0}},
     {kTagVibDepth, STR16("VibDepth"), 0, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 0.0, 120.0}},
     {kTagVibSpeed, STR16("VibSpeed"), 0, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 0.1, 20.0}},
     {kTagFiltType, STR16("FiltType"), 5, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 0.0, 5.0}},
     {kTagFiltCutoff, STR16("FiltCutoff"), 0, 1.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 6.0, 14.3, true}},
     {kTagFiltReso, STR16("FiltReso"), 0, 0.5,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {2.0, 0.1, 4.0}},
     {kTagFiltEnvAmount, STR16("FiltEnvAmount"), 0, 0.5,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, -8.0, 8.0}},
     {kTagFiltEnvA, STR16("FiltEnvA"), 0, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 1.0, 5000.0}},
     {kTagFiltEnvD, STR16("FiltEnvD"), 0, 0.5,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 1.0, 5000.0}},
     {kTagFiltEnvS, STR16("FiltEnvS"), 0, 1.0,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagFiltEnvR, STR16("FiltEnvR"), 0, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 1.0, 5000.0}},
     {kTagFiltKeyFollow, STR16("FiltKeyFollow"), 0, 1.0,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
 
     // effect params
-    {kTagEqF, STR16("EqF"), 0, 0.5, Steinberg::Vst::ParameterInfo::kCanAutomate},
-    {kTagEqG, STR16("EqG"), 0, 0.5, Steinberg::Vst::ParameterInfo::kCanAutomate},
-    {kTagEqQ, STR16("EqQ"), 0, 0.5, Steinberg::Vst::ParameterInfo::kCanAutomate},
+    {kTagEqF, STR16("EqF"), 0, 0.5,
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 4.321928094887363, 14.1357092861044, true}},
+    {kTagEqG, STR16("EqG"), 0, 0.5,
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, -12.0, 12.0}},
+    {kTagEqQ, STR16("EqQ"), 0, 0.5,
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 0.1, 4.0}},
     {kTagChorusTime, STR16("ChorusTime"), 0, 0.75,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 0.5, 20.0}},
     {kTagChorusDepth, STR16("ChorusDepth"), 0, 0.125,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
     {kTagChorusSpeed, STR16("ChorusSpeed"), 0, 0.35,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 1.0 / 30.0, 20.0}},
     {kTagChorusAmount, STR16("ChorusAmount"), 0, 0.6,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 0.0, 0.707}},
     {kTagSampleDivision, STR16("SampleDivision"), 0, 0.0,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 1.0, 8.0}},
     {kTagReverbTime, STR16("ReverbTime"), 0, 0.75,
-     Steinberg::Vst::ParameterInfo::kCanAutomate},
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {3.0, 0.1, 20.0}},
     {kTagReverbMix, STR16("ReverbMix"), 0, 0.15,
      Steinberg::Vst::ParameterInfo::kCanAutomate},
+
+    // params appended after 1.0 (older states end before these)
+    {kTagOscMode, STR16("OscMode"), 2, 0.0,
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 0.0, 2.0}},
+    {kTagPolyphony, STR16("Polyphony"), 127, 15.0 / 127.0,
+     0,
+     {1.0, 1.0, 128.0}},
+    {kTagVoiceSteal, STR16("VoiceSteal"), 2, 0.0, 0, {1.0, 0.0, 2.0}},
+    {kTagEnvCurve, STR16("EnvCurve"), 0, 0.0,
+     Steinberg::Vst::ParameterInfo::kCanAutomate,
+     {1.0, 0.0, 12.0}},
 };
-static const size_t kNumAllParameters =
+static constexpr size_t kNumAllParameters =
     sizeof(kAllParameters) / sizeof(kAllParameters[0]);
 
+static inline double toPlainValue(const ParamRange &range, double x) {
+  x = std::max(0.0, std::min(1.0, x));
+  const double t = range.warp == 1.0 ? x : std::pow(x, range.warp);
+  const double y = t * (range.max - range.min) + range.min;
+  return range.isExp2 ? std::exp2(y) : y;
+}
+
+// Dense indices into kAllParameters by tag, built at compile time, with
+// kNumAllParameters for the tags that are not there.
+namespace Detail {
+static constexpr Steinberg::Vst::ParamID getMaxParamTag() {
+  Steinberg::Vst::ParamID tag = 0;
+  for (size_t i = 0; i < kNumAllParameters; i++)
+    tag = std::max(tag, kAllParameters[i].tag);
+  return tag;
+}
+
+struct ParamIndexTable {
+  size_t index[getMaxParamTag() + 1];
+};
+
+static constexpr ParamIndexTable makeParamIndexTable() {
+  ParamIndexTable table = {};
+  for (size_t tag = 0; tag <= getMaxParamTag(); tag++)
+    table.index[tag] = kNumAllParameters;
+  for (size_t i = 0; i < kNumAllParameters; i++)
+    table.index[kAllParameters[i].tag] = i;
+  return table;
+}
+
+static constexpr bool hasUniqueParamTags() {
+  const ParamIndexTable table = makeParamIndexTable();
+  for (size_t i = 0; i < kNumAllParameters; i++)
+    if (table.index[kAllParameters[i].tag] != i)
+      return false;
+  return true;
+}
+} // namespace Detail
+
+static constexpr Detail::ParamIndexTable kParamIndexTable =
+    Detail::makeParamIndexTable();
+static_assert(Detail::hasUniqueParamTags(), "parameter tags must be unique");
+
+static constexpr size_t getParamIndex(Steinberg::Vst::ParamID tag) {
+  return tag <= Detail::getMaxParamTag() ? kParamIndexTable.index[tag]
+                                         : kNumAllParameters;
+}
+
 } // namespace AudioPlugin
@@ -2,17 +2,219 @@
 
 #include "cids.h"
 #include "parameters.h"
+#include "rtcheck.h"
 
 #include "base/source/fstreamer.h"
-#include "pluginterfaces/vst/ivstparameterchanges.h"
 
 using namespace Steinberg;
 
 namespace {
 
-static double rangeMap(double x, double xWarp, double yMin, double yMax) {
-  const double t = pow(std::max(0.0, std::min(1.0, x)), xWarp);
-  return t * (yMax - yMin) + yMin;
+// samples between the updates of a ramping parameter, the size of the blocks
+// the synth renders anyway
+static const int32 kAutomationInterval =
+    static_cast<int32>(Inharmonic::kMaxBlockSize);
+
+// How the points of an automation queue take effect within a block.
+enum class AutomationMode {
+  // at the sample of each point
+  kStep,
+  // along the lines between the points, as hosts draw them, every
+  // kAutomationInterval samples
+  kRamp,
+  // only the last point of the block, as each change rebuilds voice state
+  kCoalesce,
+};
+
+static AutomationMode getAutomationMode(Vst::ParamID tag) {
+  switch (tag) {
+  case AudioPlugin::kTagVolume:
+  case AudioPlugin::kTagExpression:
+  case AudioPlugin::kTagPitchBend:
+  case AudioPlugin::kTagModWheel:
+  case AudioPlugin::kTagSoftPedal:
+  case AudioPlugin::kTagOutVol:
+  case AudioPlugin::kTagOscMix:
+  case AudioPlugin::kTagAmpEnvS:
+  case AudioPlugin::kTagVibDepth:
+  case AudioPlugin::kTagVibSpeed:
+  case AudioPlugin::kTagFiltCutoff:
+  case AudioPlugin::kTagFiltReso:
+  case AudioPlugin::kTagFiltEnvAmount:
+  case AudioPlugin::kTagFiltEnvS:
+  case AudioPlugin::kTagEqF:
+  case AudioPlugin::kTagEqG:
+  case AudioPlugin::kTagEqQ:
+  case AudioPlugin::kTagChorusTime:
+  case AudioPlugin::kTagChorusDepth:
+  case AudioPlugin::kTagChorusSpeed:
+  case AudioPlugin::kTagChorusAmount:
+  case AudioPlugin::kTagReverbTime:
+  case AudioPlugin::kTagReverbMix:
+    return AutomationMode::kRamp;
+  case AudioPlugin::kTagInharmonic:
+  case AudioPlugin::kTagInharmonicSubscale:
+  case AudioPlugin::kTagOscMode:
+  case AudioPlugin::kTagPolyphony:
+    return AutomationMode::kCoalesce;
+  default:
+    return AutomationMode::kStep;
+  }
+}
+
+template <typename T>
+static void processEvent(Inharmonic::InharmonicSynth<T> &synth,
+                         const Vst::Event &event) {
+  switch (event.type) {
+  case Vst::Event::kNoteOnEvent:
+    if (event.noteOn.velocity != 0)
+      synth.noteOn(event.noteOn.channel, event.noteOn.pitch,
+                   event.noteOn.velocity);
+    else
+      synth.noteOff(event.noteOn.channel, event.noteOn.pitch,
+                    event.noteOn.velocity);
+    break;
+  case Vst::Event::kNoteOffEvent:
+    synth.noteOff(event.noteOff.channel, event.noteOff.pitch,
+                  event.noteOff.velocity);
+    break;
+  }
+}
+
+static bool isNoteOn(const Vst::Event &event) {
+  return event.type == Vst::Event::kNoteOnEvent && event.noteOn.velocity != 0;
+}
+
+static bool isNoteOff(const Vst::Event &event) {
+  return event.type == Vst::Event::kNoteOffEvent ||
+         (event.type == Vst::Event::kNoteOnEvent &&
+          event.noteOn.velocity == 0);
+}
+
+template <typename T>
+static void applySynthParameter(Inharmonic::InharmonicSynth<T> &synth,
+                                Vst::ParamID tag, double x) {
+  switch (tag) {
+  case AudioPlugin::kTagVolume:
+    synth.setVolume(x);
+    break;
+  case AudioPlugin::kTagExpression:
+    synth.setExpression(x);
+    break;
+  case AudioPlugin::kTagPitchBend:
+    synth.setPitchBend(x);
+    break;
+  case AudioPlugin::kTagModWheel:
+    synth.setModWheel(x);
+    break;
+  case AudioPlugin::kTagSustainPedal: {
+    bool pedal = x >= 0.99;
+    synth.setSustainPedal(pedal);
+    break;
+  }
+  case AudioPlugin::kTagSostenutoPedal: {
+    bool pedal = x >= 0.99;
+    synth.setSostenutoPedal(pedal);
+    break;
+  }
+  case AudioPlugin::kTagSoftPedal:
+    synth.setSoftPedal(x);
+    break;
+
+  case AudioPlugin::kTagOutVol:
+    synth.setOutVol(x);
+    break;
+  case AudioPlugin::kTagOscMix:
+    synth.setOscMix(x);
+    break;
+  case AudioPlugin::kTagIsRandomPhase: {
+    bool isRandom = x >= 0.5;
+    synth.setIsRandomPhase(isRandom);
+    break;
+  }
+  case AudioPlugin::kTagOscMode: {
+    int index = static_cast<int>(round(x));
+    auto mode = static_cast<Inharmonic::OscMode>(index);
+    synth.setOscMode(mode);
+    break;
+  }
+  case AudioPlugin::kTagPolyphony: {
+    size_t voices = static_cast<size_t>(round(x));
+    synth.setPolyphony(voices);
+    break;
+  }
+  case AudioPlugin::kTagVoiceSteal: {
+    int index = static_cast<int>(round(x));
+    auto steal = static_cast<Inharmonic::VoiceSteal>(index);
+    synth.setVoiceSteal(steal);
+    break;
+  }
+  case AudioPlugin::kTagEnvCurve:
+    synth.setEnvCurve(x);
+    break;
+  case AudioPlugin::kTagInharmonic:
+    synth.setInharmonic(x);
+    break;
+  case AudioPlugin::kTagInharmonicSubscale:
+    synth.setInharmonicSubscale(x);
+    break;
+  case AudioPlugin::kTagInharmKeyFollow:
+    synth.setInharmKeyFollow(x);
+    break;
+  case AudioPlugin::kTagAmpEnvA:
+    synth.setAmpEnvA(x);
+    break;
+  case AudioPlugin::kTagAmpEnvD:
+    synth.setAmpEnvD(x);
+    break;
+  case AudioPlugin::kTagAmpEnvS:
+    synth.setAmpEnvS(x);
+    break;
+  case AudioPlugin::kTagAmpEnvR:
+    synth.setAmpEnvR(x);
+    break;
+  case AudioPlugin::kTagAmpVeloSens:
+    synth.setAmpVeloSens(x);
+    break;
+  case AudioPlugin::kTagVibDelay:
+    synth.setVibDelay(x);
+    break;
+  case AudioPlugin::kTagVibDepth:
+    synth.setVibDepth(x);
+    break;
+  case AudioPlugin::kTagVibSpeed:
+    synth.setVibSpeed(x);
+    break;
+  case AudioPlugin::kTagFiltType: {
+    short type = static_cast<short>(round(x));
+    synth.setFiltType(type);
+    break;
+  }
+  case AudioPlugin::kTagFiltCutoff:
+    synth.setFiltCutoff(x);
+    break;
+  case AudioPlugin::kTagFiltReso:
+    synth.setFiltReso(x);
+    break;
+  case AudioPlugin::kTagFiltEnvAmount:
+    synth.setFiltEnvAmount(x);
+    break;
+  case AudioPlugin::kTagFiltEnvA:
+    synth.setFiltEnvA(x);
+    break;
+  case AudioPlugin::kTagFiltEnvD:
+    synth.setFiltEnvD(x);
+    break;
+  case AudioPlugin::kTagFiltEnvS:
+    synth.setFiltEnvS(x);
+    break;
+  case AudioPlugin::kTagFiltEnvR:
+    synth.setFiltEnvR(x);
+    break;
+  case AudioPlugin::kTagFiltKeyFollow:
+    synth.setFiltKeyFollow(x);
+    break;
+  }
 }
 
 } // namespace
@@ -20,6 +222,10 @@ static double rangeMap(double x, double xWarp, double yMin, double yMax) {
 namespace AudioPlugin {
 InharmonicProcessor::InharmonicProcessor() {
   setControllerClass(kInharmonicControllerUID);
+#if INHARMONIC_RT_CHECK
+  // the workers render voices for process(), so the check covers them too
+  _renderPool.setWorkerHooks(&RtCheck::enterScope, &RtCheck::leaveScope);
+#endif
 }
 
 InharmonicProcessor::~InharmonicProcessor() {}
@@ -58,193 +264,242 @@ tresult PLUGIN_API InharmonicProcessor::setBusArrangements(
 }
 
 tresult PLUGIN_API InharmonicProcessor::setActive(TBool state) {
+  // takes up a polyphony set while inactive, before processing starts
+  if (state)
+    allocateVoices();
   return AudioEffect::setActive(state);
 }
 
+// Sizes the voices of the synth to the polyphony parameter. The parameter
+// changes the polyphony within them at any time, but only this allocates.
+void InharmonicProcessor::allocateVoices() {
+  const size_t index = getParamIndex(kTagPolyphony);
+  const size_t voices = static_cast<size_t>(
+      round(toPlainValue(kAllParameters[index].range, _param[index])));
+  if (_synth32) {
+    _synth32->setMaxPolyphony(voices);
+    _synth32->setPolyphony(voices);
+  }
+  if (_synth64) {
+    _synth64->setMaxPolyphony(voices);
+    _synth64->setPolyphony(voices);
+  }
+}
+
 void InharmonicProcessor::applyParameter(Steinberg::Vst::ParamID tag,
                                          Steinberg::Vst::ParamValue value) {
-  _param[tag] = value;
+  const size_t index = getParamIndex(tag);
+  if (index == kNumAllParameters)
+    return;
+  _param[index] = value;
+  // the plain value, as the range of the parameter maps it
+  const double x = toPlainValue(kAllParameters[index].range, value);
+  if (_synth32)
+    applySynthParameter(*_synth32, tag, x);
+  if (_synth64)
+    applySynthParameter(*_synth64, tag, x);
   switch (tag) {
-  case kTagVolume:
-    _synth.setVolume(value);
-    break;
-  case kTagExpression:
-    _synth.setExpression(value);
-    break;
-  case kTagPitchBend:
-    _synth.setPitchBend(rangeMap(value, 1.0, -1.0, 1.0));
-    break;
-  case kTagModWheel:
-    _synth.setModWheel(rangeMap(value, 1.0, -1.0, 1.0));
-    break;
-  case kTagSustainPedal:
-    _synth.setSustainPedal(value >= 0.99);
-    break;
-  case kTagSostenutoPedal:
-    _synth.setSostenutoPedal(value >= 0.99);
-    break;
-  case kTagSoftPedal:
-    _synth.setSoftPedal(value);
-    break;
-
-  case kTagOutVol:
-    _synth.setOutVol(0.5 * value * value);
-    break;
-  case kTagOscMix:
-    _synth.setOscMix(value);
-    break;
-  case kTagIsRandomPhase:
-    _synth.setIsRandomPhase(value >= 0.5);
-    break;
-  case kTagInharmonic:
-    _synth.setInharmonic(0.5 * value * value * value * value * value);
-    break;
-  case kTagInharmonicSubscale:
-    _synth.setInharmonicSubscale(value);
-    break;
-  case kTagInharmKeyFollow:
-    _synth.setInharmKeyFollow(value);
-    break;
-  case kTagAmpEnvA:
-    _synth.setAmpEnvA(rangeMap(value, 5.0, 1.0, 5000.0));
-    break;
-  case kTagAmpEnvD:
-    _synth.setAmpEnvD(rangeMap(value, 3.0, 1.0, 5000.0));
-    break;
-  case kTagAmpEnvS:
-    _synth.setAmpEnvS(value);
-    break;
-  case kTagAmpEnvR:
-    _synth.setAmpEnvR(rangeMap(value, 3.0, 1.0, 5000.0));
-    break;
-  case kTagAmpVeloSens:
-    _synth.setAmpVeloSens(value);
-    break;
-  case kTagVibDelay:
-    _synth.setVibDelay(rangeMap(value, 3.0, 0.0, 2000.0));
-    break;
-  case kTagVibDepth:
-    _synth.setVibDepth(rangeMap(value, 3.0, 0.0, 120.0));
-    break;
-  case kTagVibSpeed:
-    _synth.setVibSpeed(rangeMap(value, 3.0, 0.1, 20.0));
-    break;
-  case kTagFiltType:
-    _synth.setFiltType(static_cast<short>(round(value * 5)));
-    break;
-  case kTagFiltCutoff:
-    _synth.setFiltCutoff(exp2(rangeMap(value, 1.0, 6.0, 14.3)));
-    break;
-  case kTagFiltReso:
-    _synth.setFiltReso(rangeMap(value, 2.0, 0.1, 4.0));
-    break;
-  case kTagFiltEnvAmount:
-    _synth.setFiltEnvAmount(rangeMap(value, 1.0, -8.0, 8.0));
+  case kTagSampleDivision: {
+    size_t div = static_cast<size_t>(round(x));
+    _divider.setDivision(div);
     break;
-  case kTagFiltEnvA:
-    _synth.setFiltEnvA(rangeMap(value, 3.0, 1.0, 5000.0));
+  }
+  case kTagEqF:
+    _biquadEQ.setFrequency(x);
     break;
-  case kTagFiltEnvD:
-    _synth.setFiltEnvD(rangeMap(value, 3.0, 1.0, 5000.0));
+  case kTagEqG:
+    _biquadEQ.setGain(x);
     break;
-  case kTagFiltEnvS:
-    _synth.setFiltEnvS(value);
+  case kTagEqQ:
+    _biquadEQ.setQ(x);
     break;
-  case kTagFiltEnvR:
-    _synth.setFiltEnvR(rangeMap(value, 3.0, 1.0, 5000.0));
+  case kTagChorusTime:
+    _chorus.setDelayTime(x);
     break;
-  case kTagFiltKeyFollow:
-    _synth.setFiltKeyFollow(value);
+  case kTagChorusDepth:
+    _chorus.setDepth(x);
     break;
-
-  case kTagSampleDivision: {
-    size_t div = static_cast<size_t>(round(rangeMap(value, 1.0, 1.0, 8.0)));
-    _divider32.setDivision(div);
-    _divider64.setDivision(div);
+  case kTagChorusSpeed:
+    _chorus.setSpeed(x);
     break;
-  }
-  case kTagEqF: {
-    double f = exp2(rangeMap(value, 1.0, log2(20.0), log2(18000.0)));
-    _biquadEQ32.setFrequency(f);
-    _biquadEQ64.setFrequency(f);
+  case kTagChorusAmount:
+    _chorus.setMix(x);
     break;
-  }
-  case kTagEqG: {
-    double g = rangeMap(value, 1.0, -12.0, 12.0);
-    _biquadEQ32.setGain(g);
-    _biquadEQ64.setGain(g);
-    break;
-  }
-  case kTagEqQ: {
-    double q = rangeMap(value, 3.0, 0.1, 4.0);
-    _biquadEQ32.setQ(q);
-    _biquadEQ64.setQ(q);
+  case kTagReverbTime:
+    _reverb.setTime(x);
     break;
-  }
-  case kTagChorusTime: {
-    double time = rangeMap(value, 3.0, 0.5, 20.0);
-    _chorus32.setDelayTime(time);
-    _chorus64.setDelayTime(time);
+  case kTagReverbMix:
+    _reverb.setMix(x);
     break;
   }
-  case kTagChorusDepth: {
-    double depth = rangeMap(value, 1.0, 0.0, 1.0);
-    _chorus32.setDepth(depth);
-    _chorus64.setDepth(depth);
-    break;
-  }
-  case kTagChorusSpeed: {
-    double speed = rangeMap(value, 3.0, 1.0 / 30.0, 20.0);
-    _chorus32.setSpeed(speed);
-    _chorus64.setSpeed(speed);
-    break;
-  }
-  case kTagChorusAmount: {
-    double mix = rangeMap(value, 1.0, 0.0, 0.707);
-    _chorus32.setMix(mix);
-    _chorus64.setMix(mix);
-    break;
+}
+
+// Adds an event behind those at or before its offset. Hosts send them in
+// order, so this appends, without allocating on the audio thread.
+void InharmonicProcessor::scheduleEvent(const Vst::Event &event) {
+  if (_numScheduledEvents == kMaxEvents) {
+    // a full block drops all but the note-offs, which end notes
+    if (!isNoteOff(event))
+      return;
+    size_t k = _numScheduledEvents;
+    while (k > 0 && !isNoteOn(_scheduledEvents[k - 1]))
+      k--;
+    if (k == 0) {
+      // nothing to make room with, so it takes effect at once
+      if (_synth32)
+        processEvent(*_synth32, event);
+      if (_synth64)
+        processEvent(*_synth64, event);
+      return;
+    }
+    // the latest note-on gives up its place
+    std::copy(_scheduledEvents.begin() + k,
+              _scheduledEvents.begin() + _numScheduledEvents,
+              _scheduledEvents.begin() + k - 1);
+    _numScheduledEvents--;
   }
-  case kTagReverbTime: {
-    double rt = rangeMap(value, 3.0, 0.1, 20.0);
-    _reverb32.setTime(rt);
-    _reverb64.setTime(rt);
-    break;
+  size_t i = _numScheduledEvents++;
+  for (; i > 0 && _scheduledEvents[i - 1].sampleOffset > event.sampleOffset;
+       i--)
+    _scheduledEvents[i] = _scheduledEvents[i - 1];
+  _scheduledEvents[i] = event;
+}
+
+void InharmonicProcessor::readPoint(Automation &automation) {
+  if (automation.next >= automation.end)
+    return;
+  if (automation.queue->getPoint(automation.next, automation.toOffset,
+                                 automation.toValue) != kResultTrue)
+    automation.next = automation.end;
+}
+
+void InharmonicProcessor::beginAutomation(Vst::IParameterChanges *changes) {
+  _numAutomation = 0;
+  if (!changes)
+    return;
+  int32 numParamsChanged = changes->getParameterCount();
+  for (int32 index = 0; index < numParamsChanged; index++) {
+    auto *q = changes->getParameterData(index);
+    if (!q || q->getPointCount() <= 0 || _numAutomation == _automation.size())
+      continue;
+    const size_t paramIndex = getParamIndex(q->getParameterId());
+    if (paramIndex == kNumAllParameters)
+      continue;
+    Automation &automation = _automation[_numAutomation++];
+    const AutomationMode mode = getAutomationMode(q->getParameterId());
+    automation.queue = q;
+    automation.tag = q->getParameterId();
+    automation.end = q->getPointCount();
+    automation.next =
+        mode == AutomationMode::kCoalesce ? automation.end - 1 : 0;
+    automation.isRamp = mode == AutomationMode::kRamp;
+    // a ramp to a first point past sample 0 starts from the current value
+    automation.fromOffset = 0;
+    automation.fromValue = _param[paramIndex];
+    readPoint(automation);
   }
-  case kTagReverbMix: {
-    double mix = rangeMap(value, 1.0, 0.0, 1.0);
-    _reverb32.setMix(mix);
-    _reverb64.setMix(mix);
-    break;
+}
+
+// Applies the automation due at sample offset and returns the sample of the
+// next change, at most end.
+int32 InharmonicProcessor::applyAutomation(int32 offset, int32 end) {
+  int32 next = end;
+  for (size_t k = 0; k < _numAutomation; k++) {
+    Automation &automation = _automation[k];
+    if (automation.next >= automation.end)
+      continue;
+    bool isReached = false;
+    while (automation.next < automation.end && automation.toOffset <= offset) {
+      automation.fromOffset = automation.toOffset;
+      automation.fromValue = automation.toValue;
+      automation.next++;
+      readPoint(automation);
+      isReached = true;
+    }
+    const bool isDone = automation.next >= automation.end;
+    if (isDone || !automation.isRamp ||
+        automation.toValue == automation.fromValue) {
+      if (isReached)
+        applyParameter(automation.tag, automation.fromValue);
+      if (!isDone)
+        next = std::min(next, automation.toOffset);
+      continue;
+    }
+    const double t = static_cast<double>(offset - automation.fromOffset) /
+                     (automation.toOffset - automation.fromOffset);
+    applyParameter(automation.tag,
+                   automation.fromValue +
+                       (automation.toValue - automation.fromValue) * t);
+    next = std::min(next, std::min(automation.toOffset,
+                                   offset + kAutomationInterval));
   }
+  return next;
+}
+
+// Settles the parameters whose points lie past the block on their last one.
+void InharmonicProcessor::endAutomation() {
+  for (size_t k = 0; k < _numAutomation; k++) {
+    Automation &automation = _automation[k];
+    if (automation.next >= automation.end)
+      continue;
+    automation.next = automation.end - 1;
+    readPoint(automation);
+    if (automation.next < automation.end)
+      applyParameter(automation.tag, automation.toValue);
   }
+  _numAutomation = 0;
 }
 
-tresult PLUGIN_API InharmonicProcessor::process(Vst::ProcessData &data) {
-  // Parameter processing
-  if (data.inputParameterChanges) {
-    int32 numParamsChanged = data.inputParameterChanges->getParameterCount();
-    for (int32 index = 0; index < numParamsChanged; index++) {
-      if (auto *q = data.inputParameterChanges->getParameterData(index)) {
-        int32 numPoints = q->getPointCount();
-        int32 sampleOffset;
-        Vst::ParamValue value;
-        if (q->getPoint(numPoints - 1, sampleOffset, value) == kResultTrue) {
-          applyParameter(q->getParameterId(), value);
-        }
-      }
+void InharmonicProcessor::processEffects(Vst::Sample64 *outL,
+                                         Vst::Sample64 *outR, size_t n) {
+  // each effect in turn, skipping the bypassed ones
+  _biquadEQ.process(outL, outR, n);
+  _chorus.process(outL, outR, n);
+  _divider.process(outL, outR, n);
+  _reverb.process(outL, outR, n);
+}
+
+void InharmonicProcessor::processEffects(Vst::Sample32 *outL,
+                                         Vst::Sample32 *outR, size_t n) {
+  if (!_biquadEQ.isActive() && !_chorus.isActive() && !_divider.isActive() &&
+      !_reverb.isActive())
+    return;
+  // through the chain in double, a synth block at a time
+  constexpr size_t kChunk = Inharmonic::kMaxBlockSize;
+  for (size_t offset = 0; offset < n; offset += kChunk) {
+    const size_t len = std::min(kChunk, n - offset);
+    Vst::Sample64 chunkL[kChunk];
+    Vst::Sample64 chunkR[kChunk];
+    std::copy(outL + offset, outL + offset + len, chunkL);
+    std::copy(outR + offset, outR + offset + len, chunkR);
+    processEffects(chunkL, chunkR, len);
+    for (size_t t = 0; t < len; t++) {
+      outL[offset + t] = static_cast<Vst::Sample32>(chunkL[t]);
+      outR[offset + t] = static_cast<Vst::Sample32>(chunkR[t]);
     }
   }
+}
+
+bool InharmonicProcessor::isEffectsSilent() const {
+  return _biquadEQ.isSilent() && _chorus.isSilent() && _divider.isSilent() &&
+         _reverb.isSilent();
+}
+
+tresult PLUGIN_API InharmonicProcessor::process(Vst::ProcessData &data) {
+  RtCheck::Scope rtCheckScope;
+
+  // Parameter processing, at the samples the points fall on
+  beginAutomation(data.inputParameterChanges);
 
   // Event processing
-  _scheduledEvents.clear();
+  _numScheduledEvents = 0;
   Vst::IEventList *eventList = data.inputEvents;
   if (eventList != NULL) {
     int32 numEvent = eventList->getEventCount();
     for (int32 i = 0; i < numEvent; i++) {
       Vst::Event event;
       if (eventList->getEvent(i, event) == kResultOk) {
-        _scheduledEvents.insert({event.sampleOffset, event});
+        scheduleEvent(event);
       }
     }
   }
@@ -252,76 +507,73 @@ tresult PLUGIN_API InharmonicProcessor::process(Vst::ProcessData &data) {
   // Audio processing
   if (data.numSamples > 0) {
     size_t bufsize = data.numSamples;
+    // whether the whole block is skipped for the silence of the chain
+    bool isBlockSilent = true;
 
     if (data.symbolicSampleSize == Vst::kSample32) {
       bufsize *= sizeof(Vst::Sample32);
       Vst::Sample32 *outL = data.outputs[0].channelBuffers32[0];
       Vst::Sample32 *outR = data.outputs[0].channelBuffers32[1];
 
-      for (int32 i = 0; i < data.numSamples; i++) {
-        // event processing
-        auto range = _scheduledEvents.equal_range(i);
-        for (auto it = range.first; it != range.second; it++) {
-          auto &event = it->second;
-          switch (event.type) {
-          case Vst::Event::kNoteOnEvent:
-            if (event.noteOn.velocity != 0)
-              _synth.noteOn(event.noteOn.channel, event.noteOn.pitch,
-                            event.noteOn.velocity);
-            else
-              _synth.noteOff(event.noteOn.channel, event.noteOn.pitch,
-                             event.noteOn.velocity);
-            break;
-          case Vst::Event::kNoteOffEvent:
-            _synth.noteOff(event.noteOff.channel, event.noteOff.pitch,
-                           event.noteOff.velocity);
-            break;
-          }
+      // render in sub-blocks delimited by the events and the automation
+      size_t event = 0;
+      for (int32 i = 0; i < data.numSamples;) {
+        int32 next = applyAutomation(i, data.numSamples);
+        for (; event < _numScheduledEvents &&
+               _scheduledEvents[event].sampleOffset <= i;
+             event++)
+          processEvent(*_synth32, _scheduledEvents[event]);
+        if (event < _numScheduledEvents)
+          next = std::min(next, _scheduledEvents[event].sampleOffset);
+        // a note wakes the chain up at its sample
+        _isSilent = _isSilent && _synth32->isSilent();
+        if (_isSilent) {
+          std::fill(outL + i, outL + next, 0.0f);
+          std::fill(outR + i, outR + next, 0.0f);
+          i = next;
+          continue;
         }
-
-        // process sample-by-sample
-        _synth.process32(outL[i], outR[i]);
-        _biquadEQ32.process(outL[i], outR[i]);
-        _chorus32.process(outL[i], outR[i]);
-        _divider32.process(outL[i], outR[i]);
-        _reverb32.process(outL[i], outR[i]);
+        isBlockSilent = false;
+        _synth32->process(outL + i, outR + i, next - i);
+        processEffects(outL + i, outR + i, next - i);
+        i = next;
       }
+      _isSilent = _synth32->isSilent() && isEffectsSilent();
     }
     if (data.symbolicSampleSize == Vst::kSample64) {
       bufsize *= sizeof(Vst::Sample64);
       Vst::Sample64 *outL = data.outputs[0].channelBuffers64[0];
       Vst::Sample64 *outR = data.outputs[0].channelBuffers64[1];
 
-      for (int32 i = 0; i < data.numSamples; i++) {
-        // event processing
-        auto range = _scheduledEvents.equal_range(i);
-        for (auto it = range.first; it != range.second; it++) {
-          auto &event = it->second;
-          switch (event.type) {
-          case Vst::Event::kNoteOnEvent:
-            if (event.noteOn.velocity != 0)
-              _synth.noteOn(event.noteOn.channel, event.noteOn.pitch,
-                            event.noteOn.velocity);
-            else
-              _synth.noteOff(event.noteOn.channel, event.noteOn.pitch,
-                             event.noteOn.velocity);
-            break;
-          case Vst::Event::kNoteOffEvent:
-            _synth.noteOff(event.noteOff.channel, event.noteOff.pitch,
-                           event.noteOff.velocity);
-            break;
-          }
+      // render in sub-blocks delimited by the events and the automation
+      size_t event = 0;
+      for (int32 i = 0; i < data.numSamples;) {
+        int32 next = applyAutomation(i, data.numSamples);
+        for (; event < _numScheduledEvents &&
+               _scheduledEvents[event].sampleOffset <= i;
+             event++)
+          processEvent(*_synth64, _scheduledEvents[event]);
+        if (event < _numScheduledEvents)
+          next = std::min(next, _scheduledEvents[event].sampleOffset);
+        // a note wakes the chain up at its sample
+        _isSilent = _isSilent && _synth64->isSilent();
+        if (_isSilent) {
+          std::fill(outL + i, outL + next, 0.0);
+          std::fill(outR + i, outR + next, 0.0);
+          i = next;
+          continue;
         }
-
-        // process sample-by-sample
-        _synth.process64(outL[i], outR[i]);
-        _biquadEQ64.process(outL[i], outR[i]);
-        _chorus64.process(outL[i], outR[i]);
-        _divider64.process(outL[i], outR[i]);
-        _reverb64.process(outL[i], outR[i]);
+        isBlockSilent = false;
+        _synth64->process(outL + i, outR + i, next - i);
+        processEffects(outL + i, outR + i, next - i);
+        i = next;
       }
+      _isSilent = _synth64->isSilent() && isEffectsSilent();
     }
 
+    data.outputs[0].silenceFlags =
+        isBlockSilent ? ((uint64)1 << data.outputs[0].numChannels) - 1 : 0;
+
     // clear the remaining output buffers
     for (int32 bus = 1; bus < data.numOutputs; bus++) {
       int32 numChannels = data.outputs[bus].numChannels;
@@ -333,6 +585,7 @@ tresult PLUGIN_API InharmonicProcessor::process(Vst::ProcessData &data) {
       data.outputs[bus].silenceFlags = ((uint64)1 << numChannels) - 1;
     }
   }
+  endAutomation();
 
   return kResultOk;
 }
@@ -341,14 +594,53 @@ tresult PLUGIN_API
 InharmonicProcessor::setupProcessing(Vst::ProcessSetup &newSetup) {
   // called before any processing
   double newFs = newSetup.sampleRate;
-  _synth.setSampleRate(newFs);
-  _synth.allNoteOff();
-  _biquadEQ32.setSampleRate(static_cast<float>(newFs));
-  _biquadEQ64.setSampleRate(newFs);
-  _chorus32.setSampleRate(newFs);
-  _chorus64.setSampleRate(newFs);
-  _reverb32.setSampleRate(newFs);
-  _reverb64.setSampleRate(newFs);
+
+  // one synth, for the sample size the host streams, built from the
+  // parameters when the size changes
+  bool isNewSynth = false;
+  if (newSetup.symbolicSampleSize == Vst::kSample32) {
+    _synth64.reset();
+    if (!_synth32) {
+      _synth32.reset(new Inharmonic::InharmonicSynth<float>);
+      _synth32->setRenderPool(&_renderPool);
+      isNewSynth = true;
+    }
+  } else {
+    _synth32.reset();
+    if (!_synth64) {
+      _synth64.reset(new Inharmonic::InharmonicSynth<double>);
+      _synth64->setRenderPool(&_renderPool);
+      isNewSynth = true;
+    }
+  }
+  if (isNewSynth) {
+    for (size_t i = 0; i < kNumAllParameters; i++)
+      applyParameter(kAllParameters[i].tag, _param[i]);
+  }
+  allocateVoices();
+  if (_synth32) {
+    _synth32->setSampleRate(newFs);
+    _synth32->allNoteOff();
+  }
+  if (_synth64) {
+    _synth64->setSampleRate(newFs);
+    _synth64->allNoteOff();
+  }
+
+  // offline bounces spread the voices over all cores; in real time the host
+  // owns the cores, so the build decides
+  size_t numWorkers = INHARMONIC_REALTIME_RENDER_THREADS;
+  if (newSetup.processMode == Vst::kOffline)
+    numWorkers = std::max(numWorkers,
+                          Inharmonic::RenderPool::getDefaultNumWorkers());
+  _renderPool.start(numWorkers);
+  if (_synth32)
+    _synth32->setMaxBlockSize(newSetup.maxSamplesPerBlock);
+  if (_synth64)
+    _synth64->setMaxBlockSize(newSetup.maxSamplesPerBlock);
+  _biquadEQ.setSampleRate(newFs);
+  _chorus.setSampleRate(newFs);
+  _reverb.setSampleRate(newFs);
 
   return AudioEffect::setupProcessing(newSetup);
 }
@@ -368,7 +660,8 @@ tresult PLUGIN_API InharmonicProcessor::setState(IBStream *state) {
 
   for (size_t i = 0; i < kNumAllParameters; i++) {
     double value = 0.5;
-    streamer.readDouble(value);
+    if (!streamer.readDouble(value))
+      value = kAllParameters[i].defaultValueNormalized;
     applyParameter(kAllParameters[i].tag, value);
   }
 
@@ -380,7 +673,7 @@ tresult PLUGIN_API InharmonicProcessor::getState(IBStream *state) {
   IBStreamer streamer(state, kLittleEndian);
 
   for (size_t i = 0; i < kNumAllParameters; i++) {
-    streamer.writeDouble(_param[kAllParameters[i].tag]);
+    streamer.writeDouble(_param[i]);
   }
 
   return kResultOk;
@@ -1,11 +1,14 @@
 #pragma once
 #include "dsp/effect.h"
 #include "dsp/inharmonic.h"
+#include "parameters.h"
 
 #include "pluginterfaces/vst/ivstevents.h"
+#include "pluginterfaces/vst/ivstparameterchanges.h"
 #include "public.sdk/source/vst/vstaudioeffect.h"
 
-#include <map>
+#include <array>
+#include <memory>
 
 namespace AudioPlugin {
 
@@ -55,21 +58,64 @@ public:
       SMTG_OVERRIDE;
 
 protected:
-  Inharmonic::InharmonicSynth _synth;
-  Effect::SampleDivider<float> _divider32;
-  Effect::SampleDivider<double> _divider64;
-  Effect::BiquadEQ<float> _biquadEQ32;
-  Effect::BiquadEQ<double> _biquadEQ64;
-  Effect::Chorus<float> _chorus32;
-  Effect::Chorus<double> _chorus64;
-  Effect::Reverb<float> _reverb32;
-  Effect::Reverb<double> _reverb64;
-
-  std::map<Steinberg::Vst::ParamID, Steinberg::Vst::ParamValue> _param = {};
-  std::multimap<Steinberg::int32, Steinberg::Vst::Event> _scheduledEvents = {};
+  // declared before the synths, which render on it
+  Inharmonic::RenderPool _renderPool;
+  // the synth of the sample size set up in setupProcessing(), the other one
+  // being null, as the host only ever streams one of them
+  std::unique_ptr<Inharmonic::InharmonicSynth<float>> _synth32;
+  std::unique_ptr<Inharmonic::InharmonicSynth<double>> _synth64;
+  // one chain for either sample size, in double, as the host only ever
+  // streams one of them
+  Effect::SampleDivider<double> _divider;
+  Effect::BiquadEQ<double> _biquadEQ;
+  Effect::Chorus<double> _chorus;
+  Effect::Reverb<double> _reverb;
+
+  // The automation of one parameter in the current block: the value heads
+  // from the last point reached (or the value the block began with) to the
+  // point next, up to end.
+  struct Automation {
+    Steinberg::Vst::IParamValueQueue *queue;
+    Steinberg::Vst::ParamID tag;
+    Steinberg::int32 next;
+    Steinberg::int32 end;
+    Steinberg::int32 fromOffset;
+    Steinberg::Vst::ParamValue fromValue;
+    Steinberg::int32 toOffset;
+    Steinberg::Vst::ParamValue toValue;
+    bool isRamp;
+  };
+
+  // The most events a block takes. Past that, all but note-offs are dropped: a
+  // note-off takes the place of the latest note-on queued, or applies at the
+  // start of the block if there is none.
+  static constexpr size_t kMaxEvents = 1024;
+
+  // the normalized values by index in kAllParameters
+  std::array<Steinberg::Vst::ParamValue, kNumAllParameters> _param = {};
+  // the events of the current block, in time order
+  std::array<Steinberg::Vst::Event, kMaxEvents> _scheduledEvents = {};
+  size_t _numScheduledEvents = 0;
+  std::array<Automation, kNumAllParameters> _automation = {};
+  size_t _numAutomation = 0;
+  // Set while no voice sounds and the tails of the effects have died away,
+  // when process() writes zeros instead of running the chain.
+  bool _isSilent = true;
 
   void applyParameter(Steinberg::Vst::ParamID tag,
                       Steinberg::Vst::ParamValue value);
+  void allocateVoices();
+  void scheduleEvent(const Steinberg::Vst::Event &event);
+  void processEffects(Steinberg::Vst::Sample64 *outL,
+                      Steinberg::Vst::Sample64 *outR, size_t n);
+  void processEffects(Steinberg::Vst::Sample32 *outL,
+                      Steinberg::Vst::Sample32 *outR, size_t n);
+  bool isEffectsSilent() const;
+  void beginAutomation(Steinberg::Vst::IParameterChanges *changes);
+  Steinberg::int32 applyAutomation(Steinberg::int32 offset,
+                                   Steinberg::int32 end);
+  void endAutomation();
+  static void readPoint(Automation &automation);
 };
 
 } // namespace AudioPlugin
@@ -0,0 +1,314 @@
+#include "rtcheck.h"
+
+#if INHARMONIC_RT_CHECK
+
+#if defined(_WIN32)
+#error "INHARMONIC_RT_CHECK needs a POSIX platform"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+
+// the exception specifications the C library declares its functions with
+#if defined(__GLIBC__)
+#define RT_CHECK_THROW __THROW
+#define RT_CHECK_THROWNL __THROWNL
+#else
+#define RT_CHECK_THROW
+#define RT_CHECK_THROWNL
+#endif
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *p);
+}
+#endif
+
+namespace {
+
+// the real functions behind the hooks
+struct RealFunctions {
+  int (*pthreadMutexLock)(pthread_mutex_t *);
+  int (*pthreadRwlockRdlock)(pthread_rwlock_t *);
+  int (*pthreadRwlockWrlock)(pthread_rwlock_t *);
+  int (*pthreadCondWait)(pthread_cond_t *, pthread_mutex_t *);
+  int (*pthreadCondTimedwait)(pthread_cond_t *, pthread_mutex_t *,
+                              const struct timespec *);
+  int (*semWait)(sem_t *);
+  int (*nanosleep)(const struct timespec *, struct timespec *);
+  int (*usleep)(useconds_t);
+  unsigned int (*sleep)(unsigned int);
+  ssize_t (*read)(int, void *, size_t);
+  ssize_t (*write)(int, const void *, size_t);
+};
+
+template <typename F> void resolve(F &f, const char *name) {
+  f = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+// Looks the real functions up on first use, which static initialization
+// makes sure happens outside of any scope.
+const RealFunctions &getReal() {
+  static const RealFunctions real = [] {
+    RealFunctions r;
+    resolve(r.pthreadMutexLock, "pthread_mutex_lock");
+    resolve(r.pthreadRwlockRdlock, "pthread_rwlock_rdlock");
+    resolve(r.pthreadRwlockWrlock, "pthread_rwlock_wrlock");
+    resolve(r.pthreadCondWait, "pthread_cond_wait");
+    resolve(r.pthreadCondTimedwait, "pthread_cond_timedwait");
+    resolve(r.semWait, "sem_wait");
+    resolve(r.nanosleep, "nanosleep");
+    resolve(r.usleep, "usleep");
+    resolve(r.sleep, "sleep");
+    resolve(r.read, "read");
+    resolve(r.write, "write");
+    return r;
+  }();
+  return real;
+}
+
+// plain data, so that the hooks may touch them before static initialization
+thread_local int t_scopeDepth = 0;
+thread_local bool t_isReporting = false;
+std::atomic<size_t> g_numViolations(0);
+
+constexpr int kMaxFrames = 64;
+
+void writeError(const char *s) {
+  getReal().write(STDERR_FILENO, s, std::strlen(s));
+}
+
+// Reports call if the thread is inside a scope. The report neither allocates
+// nor comes back here.
+void check(const char *call) {
+  if (t_scopeDepth == 0 || t_isReporting)
+    return;
+  t_isReporting = true;
+  g_numViolations.fetch_add(1, std::memory_order_relaxed);
+  writeError("Inharmonic RT check: ");
+  writeError(call);
+  writeError(" in the audio callback\n");
+  void *frames[kMaxFrames];
+  const int numFrames = backtrace(frames, kMaxFrames);
+  // from the hook on, leaving out check() itself
+  backtrace_symbols_fd(frames + 1, numFrames - 1, STDERR_FILENO);
+  t_isReporting = false;
+}
+
+// Resolves the real functions and loads what backtrace() loads on its first
+// call, both of which allocate.
+struct Init {
+  Init() {
+    getReal();
+    void *frame;
+    backtrace(&frame, 1);
+  }
+} g_init;
+
+void *rawMalloc(size_t size) {
+#if defined(__GLIBC__)
+  return __libc_malloc(size);
+#else
+  return std::malloc(size);
+#endif
+}
+
+void *rawMemalign(size_t alignment, size_t size) {
+#if defined(__GLIBC__)
+  return __libc_memalign(alignment, size);
+#else
+  void *p = nullptr;
+  return posix_memalign(&p, std::max(alignment, sizeof(void *)), size) == 0
+             ? p
+             : nullptr;
+#endif
+}
+
+void rawFree(void *p) {
+#if defined(__GLIBC__)
+  __libc_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+void *newBlock(size_t size, size_t alignment, const char *call) {
+  check(call);
+  if (size == 0)
+    size = 1;
+  void *p = alignment == 0 ? rawMalloc(size) : rawMemalign(alignment, size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *newBlockNothrow(size_t size, size_t alignment, const char *call) {
+  try {
+    return newBlock(size, alignment, call);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void deleteBlock(void *p, const char *call) {
+  check(call);
+  rawFree(p);
+}
+
+} // namespace
+
+namespace AudioPlugin {
+namespace RtCheck {
+
+Scope::Scope() { t_scopeDepth++; }
+Scope::~Scope() { t_scopeDepth--; }
+
+void enterScope() { t_scopeDepth++; }
+void leaveScope() { t_scopeDepth--; }
+
+size_t getNumViolations() {
+  return g_numViolations.load(std::memory_order_relaxed);
+}
+
+} // namespace RtCheck
+} // namespace AudioPlugin
+
+// allocation
+void *operator new(size_t size) { return newBlock(size, 0, "operator new"); }
+void *operator new[](size_t size) {
+  return newBlock(size, 0, "operator new[]");
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return newBlockNothrow(size, 0, "operator new");
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return newBlockNothrow(size, 0, "operator new[]");
+}
+void operator delete(void *p) noexcept { deleteBlock(p, "operator delete"); }
+void operator delete[](void *p) noexcept {
+  deleteBlock(p, "operator delete[]");
+}
+void operator delete(void *p, size_t) noexcept {
+  deleteBlock(p, "operator delete");
+}
+void operator delete[](void *p, size_t) noexcept {
+  deleteBlock(p, "operator delete[]");
+}
+#if defined(__cpp_aligned_new)
+void *operator new(size_t size, std::align_val_t alignment) {
+  return newBlock(size, static_cast<size_t>(alignment), "operator new");
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return newBlock(size, static_cast<size_t>(alignment), "operator new[]");
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+  deleteBlock(p, "operator delete");
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+  deleteBlock(p, "operator delete[]");
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  deleteBlock(p, "operator delete");
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  deleteBlock(p, "operator delete[]");
+}
+#endif
+
+extern "C" {
+
+#if defined(__GLIBC__)
+// Elsewhere the C library cannot be reached under its own malloc, so only
+// operator new is seen.
+void *malloc(size_t size) RT_CHECK_THROW {
+  check("malloc");
+  return __libc_malloc(size);
+}
+void *calloc(size_t count, size_t size) RT_CHECK_THROW {
+  check("calloc");
+  return __libc_calloc(count, size);
+}
+void *realloc(void *p, size_t size) RT_CHECK_THROW {
+  check("realloc");
+  return __libc_realloc(p, size);
+}
+int posix_memalign(void **p, size_t alignment, size_t size) RT_CHECK_THROW {
+  check("posix_memalign");
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  *p = __libc_memalign(alignment, size);
+  return *p != nullptr ? 0 : ENOMEM;
+}
+void free(void *p) RT_CHECK_THROW {
+  check("free");
+  __libc_free(p);
+}
+#endif
+
+// locks and waits
+int pthread_mutex_lock(pthread_mutex_t *mutex) RT_CHECK_THROWNL {
+  check("pthread_mutex_lock");
+  return getReal().pthreadMutexLock(mutex);
+}
+int pthread_rwlock_rdlock(pthread_rwlock_t *lock) RT_CHECK_THROWNL {
+  check("pthread_rwlock_rdlock");
+  return getReal().pthreadRwlockRdlock(lock);
+}
+int pthread_rwlock_wrlock(pthread_rwlock_t *lock) RT_CHECK_THROWNL {
+  check("pthread_rwlock_wrlock");
+  return getReal().pthreadRwlockWrlock(lock);
+}
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  check("pthread_cond_wait");
+  return getReal().pthreadCondWait(cond, mutex);
+}
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *time) {
+  check("pthread_cond_timedwait");
+  return getReal().pthreadCondTimedwait(cond, mutex, time);
+}
+int sem_wait(sem_t *sem) {
+  check("sem_wait");
+  return getReal().semWait(sem);
+}
+
+// blocking system calls
+int nanosleep(const struct timespec *time, struct timespec *remain) {
+  check("nanosleep");
+  return getReal().nanosleep(time, remain);
+}
+int usleep(useconds_t time) {
+  check("usleep");
+  return getReal().usleep(time);
+}
+unsigned int sleep(unsigned int time) {
+  check("sleep");
+  return getReal().sleep(time);
+}
+ssize_t read(int fd, void *buffer, size_t size) {
+  check("read");
+  return getReal().read(fd, buffer, size);
+}
+ssize_t write(int fd, const void *buffer, size_t size) {
+  check("write");
+  return getReal().write(fd, buffer, size);
+}
+
+} // extern "C"
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+// Builds with INHARMONIC_RT_CHECK=1 catch the calls that are not real-time
+// safe on a thread while it is inside an RtCheck::Scope: allocation (malloc,
+// operator new and their kin), mutex and condition variable waits,
+// semaphore waits, sleeps and file I/O. Each one is printed to stderr with a
+// stack trace and counted, and the call then goes ahead. The hooks replace
+// the library functions for the plugin's own calls only, as the build binds
+// them within its binary (malloc and its kin on glibc alone); POSIX only.
+#ifndef INHARMONIC_RT_CHECK
+#define INHARMONIC_RT_CHECK 0
+#endif
+
+namespace AudioPlugin {
+namespace RtCheck {
+
+#if INHARMONIC_RT_CHECK
+// Marks the calling thread as running the audio callback while in scope.
+class Scope {
+public:
+  Scope();
+  ~Scope();
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+};
+
+// The same as a Scope from enterScope() to leaveScope(), for threads that
+// run part of the callback from code that cannot hold one.
+void enterScope();
+void leaveScope();
+
+// the calls caught so far, on any thread
+size_t getNumViolations();
+#else
+class Scope {
+public:
+  Scope() {}
+};
+
+static inline void enterScope() {}
+static inline void leaveScope() {}
+static inline size_t getNumViolations() { return 0; }
+#endif
+
+} // namespace RtCheck
+} // namespace AudioPlugin
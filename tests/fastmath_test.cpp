@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+// Checks the polynomial functions of source/dsp/fastmath.h against libm, to
+// the error bounds documented there, over the argument ranges of their call
+// sites and over the full documented ranges.
+#define INHARMONIC_FAST_MATH 1
+#include "dsp/fastmath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+
+namespace {
+
+namespace FastMath = Inharmonic::FastMath;
+
+constexpr double kPi = 3.14159265358979323846;
+
+int g_numFailures = 0;
+
+// Samples [lo, hi] on a uniform grid and at random points, and returns the
+// largest error found.
+double getMaxError(double lo, double hi,
+                   const std::function<double(double)> &error) {
+  constexpr int kNumSteps = 200000;
+  std::mt19937_64 random(1);
+  std::uniform_real_distribution<double> uniform(lo, hi);
+  double maxError = 0;
+  for (int i = 0; i <= kNumSteps; i++) {
+    maxError = std::max(maxError, error(lo + (hi - lo) * i / kNumSteps));
+    maxError = std::max(maxError, error(uniform(random)));
+  }
+  return maxError;
+}
+
+void expect(const char *name, double lo, double hi, double bound,
+            const std::function<double(double)> &error) {
+  const double maxError = getMaxError(lo, hi, error);
+  const bool isPassed = maxError <= bound;
+  std::printf("%s %s over [%g, %g]: %.3g (bound %.3g)\n",
+              isPassed ? "ok  " : "FAIL", name, lo, hi, maxError, bound);
+  if (!isPassed)
+    g_numFailures++;
+}
+
+double exp2Error(double x) {
+  return std::abs(FastMath::exp2(x) / std::exp2(x) - 1);
+}
+
+double sinError(double x) { return std::abs(FastMath::sin(x) - std::sin(x)); }
+
+double cosError(double x) { return std::abs(FastMath::cos(x) - std::cos(x)); }
+
+double sincosError(double x) {
+  double s, c;
+  FastMath::sincos(x, s, c);
+  // the same polynomials as sin() and cos(), so the same bounds
+  return std::max(std::abs(s - std::sin(x)) / 2.7e-11,
+                  std::abs(c - std::cos(x)) / 3.1e-12);
+}
+
+double pow10Error(double x) {
+  return std::abs(FastMath::pow10(x) / std::pow(10.0, x) - 1) /
+         (2.2e-12 + 7.7e-16 * std::abs(x));
+}
+
+} // namespace
+
+int main() {
+  // note pitches, bends, vibrato, the cutoff envelope and key follows, and
+  // the envelope curve all stay within 24 octaves
+  expect("exp2", -24, 24, 2.2e-12, exp2Error);
+  expect("exp2", -1022, 1022, 2.2e-12, exp2Error);
+  for (int i = -1022; i <= 1022; i++) {
+    if (FastMath::exp2(i) != std::exp2(i)) {
+      std::printf("FAIL exp2 inexact at %d\n", i);
+      g_numFailures++;
+    }
+  }
+
+  // filter cutoffs up to Nyquist, oscillator phases and EQ frequencies
+  expect("sin", -2 * kPi, 2 * kPi, 2.7e-11, sinError);
+  expect("sin", -1e5, 1e5, 2.7e-11, sinError);
+  expect("cos", -2 * kPi, 2 * kPi, 3.1e-12, cosError);
+  expect("cos", -100 * kPi, 100 * kPi, 3.1e-12, cosError);
+  // sincos() reports its error relative to the bounds of sin() and cos()
+  expect("sincos", -2 * kPi, 2 * kPi, 1, sincosError);
+  expect("sincos", -100 * kPi, 100 * kPi, 1, sincosError);
+
+  // EQ gains and reverb feedback, and the documented growth beyond them
+  expect("pow10", -12, 12, 1, pow10Error);
+  expect("pow10", -300, 300, 1, pow10Error);
+
+  return g_numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: MIT
+// Checks every partial bank and phasor bank kernel of source/dsp/partialbank.h
+// that this CPU can run, in double and float, on random partials against the
+// same sums taken in long double, to the n * EPSILON * sum(|amp|) bound
+// documented there. The table kernels must also advance the phases exactly as
+// the scalar one does.
+#include "dsp/costable.h"
+#include "dsp/partialbank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+namespace Bank = Inharmonic;
+
+constexpr double kPi = 3.14159265358979323846;
+
+constexpr size_t kMaxPartials = 128;
+constexpr size_t kNumSamples = 64;
+constexpr int kNumSets = 200;
+
+int g_numFailures = 0;
+
+template <typename T> struct Kernels {
+  const char *name;
+  Bank::PartialBankKernel<T> table;
+  Bank::PhasorBankKernel<T> phasor;
+};
+
+// the scalar kernels, which every CPU can fall back on, and those
+// detectPartialBankKernels() may pick here
+template <typename T> std::vector<Kernels<T>> getKernels() {
+  std::vector<Kernels<T>> kernels = {
+      {"scalar", Bank::partialBankScalar<T>, Bank::phasorBankScalar<T>}};
+#if defined(INHARMONIC_PARTIALBANK_X86)
+  kernels.push_back({"sse2", Bank::partialBankSSE2, Bank::phasorBankSSE2});
+  if (Bank::cpuHasAVX2())
+    kernels.push_back({"avx2", Bank::partialBankAVX2, Bank::phasorBankAVX2});
+#elif defined(INHARMONIC_PARTIALBANK_NEON)
+  kernels.push_back({"neon", Bank::partialBankNEON, Bank::phasorBankNEON});
+#endif
+  return kernels;
+}
+
+// A random set of n partials, the last few of them padding.
+template <typename T> struct PartialSet {
+  size_t n;
+  alignas(Bank::kPartialBankAlign) T amp[kMaxPartials];
+  alignas(Bank::kPartialBankAlign) T steps[kMaxPartials];
+  alignas(Bank::kPartialBankAlign) T phase[kMaxPartials];
+  alignas(Bank::kPartialBankAlign) T rotRe[kMaxPartials];
+  alignas(Bank::kPartialBankAlign) T rotIm[kMaxPartials];
+  alignas(Bank::kPartialBankAlign) T re[kMaxPartials];
+  alignas(Bank::kPartialBankAlign) T im[kMaxPartials];
+  T oscMod[kNumSamples];
+
+  explicit PartialSet(std::mt19937_64 &random) {
+    std::uniform_int_distribution<size_t> lanes(
+        1, kMaxPartials / Bank::kPartialBankLanes);
+    std::uniform_real_distribution<double> unit(0, 1);
+    n = lanes(random) * Bank::kPartialBankLanes;
+    const size_t numUsed = n - random() % Bank::kPartialBankLanes;
+    for (size_t i = 0; i < n; i++) {
+      const bool isUsed = i < numUsed;
+      amp[i] = isUsed ? static_cast<T>((2 * unit(random) - 1) / numUsed) : 0;
+      steps[i] = isUsed ? static_cast<T>(0.5 * unit(random)) : 0;
+      phase[i] = static_cast<T>(unit(random));
+      const double angle = 2 * kPi * steps[i];
+      rotRe[i] = static_cast<T>(std::cos(angle));
+      rotIm[i] = static_cast<T>(std::sin(angle));
+      re[i] = static_cast<T>(std::cos(2 * kPi * phase[i]));
+      im[i] = static_cast<T>(std::sin(2 * kPi * phase[i]));
+    }
+    // a vibrato-like modulation around 1
+    for (size_t t = 0; t < kNumSamples; t++)
+      oscMod[t] = static_cast<T>(1 + 0.1 * (2 * unit(random) - 1));
+  }
+
+  double getBound() const {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+      sum += std::abs(static_cast<double>(amp[i]));
+    return n * std::numeric_limits<T>::epsilon() * sum;
+  }
+};
+
+// The table sum of the scalar kernel, summed in long double.
+template <typename T>
+void renderTableReference(PartialSet<T> &set, long double *out) {
+  const T tableScale = static_cast<T>(Bank::kCosTableSize);
+  for (size_t t = 0; t < kNumSamples; t++) {
+    long double sum = 0;
+    for (size_t i = 0; i < set.n; i++) {
+      const T pos = set.phase[i] * tableScale;
+      const int k = static_cast<int>(pos);
+      const T frac = pos - static_cast<T>(k);
+      const float *step = Bank::kCosTable.data + 2 * k;
+      sum += static_cast<T>(set.amp[i] * (step[0] + frac * step[1]));
+      set.phase[i] += set.steps[i] * set.oscMod[t];
+      set.phase[i] -= static_cast<int>(set.phase[i]);
+    }
+    out[t] = sum;
+  }
+}
+
+// The phasor sum of the scalar kernel, summed in long double.
+template <typename T>
+void renderPhasorReference(PartialSet<T> &set, long double *out) {
+  for (size_t t = 0; t < kNumSamples; t++) {
+    long double sum = 0;
+    for (size_t i = 0; i < set.n; i++) {
+      sum += static_cast<T>(set.amp[i] * set.re[i]);
+      const T r = set.re[i] * set.rotRe[i] - set.im[i] * set.rotIm[i];
+      set.im[i] = set.re[i] * set.rotIm[i] + set.im[i] * set.rotRe[i];
+      set.re[i] = r;
+    }
+    out[t] = sum;
+  }
+}
+
+template <typename T>
+double getMaxError(const T *out, const long double *reference) {
+  double maxError = 0;
+  for (size_t t = 0; t < kNumSamples; t++)
+    maxError = std::max(
+        maxError, static_cast<double>(std::abs(out[t] - reference[t])));
+  return maxError;
+}
+
+void expect(const char *kernel, const char *type, const char *bank,
+            double maxRatio) {
+  const bool isPassed = maxRatio <= 1;
+  std::printf("%s %s %s %s: %.3g of the bound\n", isPassed ? "ok  " : "FAIL",
+              kernel, bank, type, maxRatio);
+  if (!isPassed)
+    g_numFailures++;
+}
+
+template <typename T> void check(const char *type) {
+  for (const Kernels<T> &kernels : getKernels<T>()) {
+    std::mt19937_64 random(1);
+    double maxTableRatio = 0;
+    double maxPhasorRatio = 0;
+    bool isPhaseExact = true;
+    for (int s = 0; s < kNumSets; s++) {
+      const PartialSet<T> set(random);
+      const double bound = set.getBound();
+      T out[kNumSamples];
+      long double reference[kNumSamples];
+
+      PartialSet<T> expected = set;
+      PartialSet<T> actual = set;
+      renderTableReference(expected, reference);
+      kernels.table(actual.amp, actual.steps, actual.phase, actual.n,
+                    actual.oscMod, out, kNumSamples, Bank::kCosTable.data,
+                    static_cast<T>(Bank::kCosTableSize));
+      maxTableRatio =
+          std::max(maxTableRatio, getMaxError(out, reference) / bound);
+      isPhaseExact = isPhaseExact && std::equal(actual.phase,
+                                                actual.phase + actual.n,
+                                                expected.phase);
+
+      expected = set;
+      actual = set;
+      renderPhasorReference(expected, reference);
+      kernels.phasor(actual.amp, actual.rotRe, actual.rotIm, actual.re,
+                     actual.im, actual.n, out, kNumSamples);
+      maxPhasorRatio =
+          std::max(maxPhasorRatio, getMaxError(out, reference) / bound);
+    }
+    expect(kernels.name, type, "table", maxTableRatio);
+    expect(kernels.name, type, "phasor", maxPhasorRatio);
+    if (!isPhaseExact) {
+      std::printf("FAIL %s table %s phases differ from the scalar kernel\n",
+                  kernels.name, type);
+      g_numFailures++;
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  check<double>("double");
+  check<float>("float");
+  return g_numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: MIT
+// Runs InharmonicProcessor::process() without a host, in a build with
+// INHARMONIC_RT_CHECK=1, and fails if the check caught any call that is not
+// real-time safe. The blocks carry note storms, bursts of automation on every
+// parameter and preset loads in between, in both sample sizes, in real time
+// and offline (where the voices render on the pool's workers).
+#include "processor.h"
+#include "rtcheck.h"
+
+#include "base/source/fstreamer.h"
+#include "public.sdk/source/common/memorystream.h"
+#include "public.sdk/source/vst/hosting/eventlist.h"
+#include "public.sdk/source/vst/hosting/parameterchanges.h"
+
+#include <cstdio>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+using namespace Steinberg;
+
+namespace {
+
+constexpr int32 kMaxBlockSize = 1024;
+constexpr int kNumBlocks = 1000;
+constexpr int kMaxEventsPerBlock = 128;
+
+// Note-ons and note-offs of random pitches in time order, many more than the
+// voices, so that most of them steal.
+void addNoteStorm(Vst::EventList &events, int32 numSamples,
+                  std::mt19937 &random) {
+  std::uniform_int_distribution<int> pitch(0, 127);
+  std::uniform_real_distribution<float> velocity(0, 1);
+  for (int i = 0; i < kMaxEventsPerBlock; i++) {
+    Vst::Event e = {};
+    e.sampleOffset = numSamples * i / kMaxEventsPerBlock;
+    if (random() % 3 != 0) {
+      e.type = Vst::Event::kNoteOnEvent;
+      e.noteOn.pitch = static_cast<int16>(pitch(random));
+      e.noteOn.velocity = velocity(random);
+      e.noteOn.noteId = -1;
+    } else {
+      e.type = Vst::Event::kNoteOffEvent;
+      e.noteOff.pitch = static_cast<int16>(pitch(random));
+      e.noteOff.velocity = velocity(random);
+      e.noteOff.noteId = -1;
+    }
+    events.addEvent(e);
+  }
+}
+
+// A handful of points on every parameter, spread over the block.
+void addAutomationBurst(Vst::ParameterChanges &changes, int32 numSamples,
+                        std::mt19937 &random) {
+  std::uniform_real_distribution<double> value(0, 1);
+  for (size_t i = 0; i < AudioPlugin::kNumAllParameters; i++) {
+    int32 index;
+    Vst::IParamValueQueue *queue =
+        changes.addParameterData(AudioPlugin::kAllParameters[i].tag, index);
+    const int32 numPoints = 1 + static_cast<int32>(random() % 8);
+    for (int32 k = 0; k < numPoints; k++)
+      queue->addPoint(numSamples * k / numPoints, value(random), index);
+  }
+}
+
+// Loads a state of random parameter values, as a host loads a preset.
+void loadRandomPreset(AudioPlugin::InharmonicProcessor &processor,
+                      std::mt19937 &random) {
+  std::uniform_real_distribution<double> value(0, 1);
+  MemoryStream stream;
+  IBStreamer streamer(&stream, kLittleEndian);
+  for (size_t i = 0; i < AudioPlugin::kNumAllParameters; i++)
+    streamer.writeDouble(value(random));
+  stream.seek(0, IBStream::kIBSeekSet, nullptr);
+  processor.setState(&stream);
+}
+
+void run(int32 processMode, int32 sampleSize) {
+  std::printf("%s, %d-bit\n",
+              processMode == Vst::kOffline ? "offline" : "real time",
+              sampleSize == Vst::kSample32 ? 32 : 64);
+  std::mt19937 random(1);
+
+  auto *processor = new AudioPlugin::InharmonicProcessor;
+  processor->initialize(nullptr);
+  Vst::ProcessSetup setup = {};
+  setup.processMode = processMode;
+  setup.symbolicSampleSize = sampleSize;
+  setup.maxSamplesPerBlock = kMaxBlockSize;
+  setup.sampleRate = 48000;
+  processor->setupProcessing(setup);
+  processor->setActive(true);
+  processor->setProcessing(true);
+
+  std::vector<Vst::Sample32> out32(2 * kMaxBlockSize);
+  std::vector<Vst::Sample64> out64(2 * kMaxBlockSize);
+  Vst::Sample32 *channels32[] = {out32.data(), out32.data() + kMaxBlockSize};
+  Vst::Sample64 *channels64[] = {out64.data(), out64.data() + kMaxBlockSize};
+  Vst::AudioBusBuffers output = {};
+  output.numChannels = 2;
+  if (sampleSize == Vst::kSample32)
+    output.channelBuffers32 = channels32;
+  else
+    output.channelBuffers64 = channels64;
+
+  Vst::EventList events(kMaxEventsPerBlock);
+  Vst::ParameterChanges changes(
+      static_cast<int32>(AudioPlugin::kNumAllParameters));
+  std::uniform_int_distribution<int32> blockSize(1, kMaxBlockSize);
+  for (int b = 0; b < kNumBlocks; b++) {
+    const int32 numSamples = blockSize(random);
+    events.clear();
+    changes.clearQueue();
+    // storms and bursts now and then, with quiet stretches for the tails to
+    // die away and the silence skip to take over
+    switch (random() % 16) {
+    case 0:
+      addNoteStorm(events, numSamples, random);
+      break;
+    case 1:
+      addAutomationBurst(changes, numSamples, random);
+      break;
+    case 2:
+      addNoteStorm(events, numSamples, random);
+      addAutomationBurst(changes, numSamples, random);
+      break;
+    case 3:
+      loadRandomPreset(*processor, random);
+      break;
+    default:
+      break;
+    }
+
+    Vst::ProcessData data = {};
+    data.processMode = processMode;
+    data.symbolicSampleSize = sampleSize;
+    data.numSamples = numSamples;
+    data.numOutputs = 1;
+    data.outputs = &output;
+    data.inputEvents = &events;
+    data.inputParameterChanges = &changes;
+    processor->process(data);
+  }
+
+  processor->setProcessing(false);
+  processor->setActive(false);
+  processor->terminate();
+  processor->release();
+}
+
+} // namespace
+
+int main() {
+  for (int32 mode : {Vst::kRealtime, Vst::kOffline}) {
+    for (int32 size : {Vst::kSample32, Vst::kSample64})
+      run(mode, size);
+  }
+
+  const size_t numViolations = AudioPlugin::RtCheck::getNumViolations();
+  std::printf("%zu unsafe calls in process()\n", numViolations);
+  return numViolations == 0 ? 0 : 1;
+}